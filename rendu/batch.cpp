@@ -0,0 +1,281 @@
+#include "batch.h"
+#include "extension.h"
+#include "helper.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+// Reads the manifest, skipping empty lines and comments (#). Malformed lines are reported and skipped.
+vector<BatchJob> read_manifest(const string &name)
+{
+    vector<BatchJob> jobs;
+    ifstream file(name.c_str());
+    if (!file) {
+        cout << "Error: manifest " << name << " can't be read." << endl;
+        return jobs;
+    }
+    string line;
+    for (size_t number(1) ; getline(file, line) ; ++number) {
+        istringstream fields(line);
+        string first;
+        if (!(fields >> first) || first[0] == '#') {
+            continue;
+        }
+        BatchJob job;
+        job.input = first;
+        string rest;
+        if (!(fields >> job.width >> job.height >> job.output) || (fields >> rest)) {
+            cout << "Error: line " << number << " of manifest " << name << " is malformed." << endl;
+            continue;
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static bool is_image(const string &name)
+{
+    const char *extensions[] = {".jpg", ".jpeg", ".JPG", ".JPEG", ".png", ".PNG"};
+    for (const string extension : extensions) {
+        if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+vector<BatchJob> directory_jobs(const string &input_dir, const string &output_dir, size_t width, size_t height)
+{
+    vector<BatchJob> jobs;
+    vector<string> names;
+#ifndef _WIN32
+    DIR *directory(opendir(input_dir.c_str()));
+    if (!directory) {
+        cout << "Error: directory " << input_dir << " can't be read." << endl;
+        return jobs;
+    }
+    for (dirent *entry(readdir(directory)) ; entry ; entry = readdir(directory)) {
+        if (is_image(entry->d_name)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(directory);
+#else
+    cout << "Error: directory " << input_dir << " can't be read (not supported on this system)." << endl;
+#endif
+    sort(names.begin(), names.end());
+    for (size_t i(0) ; i < names.size() ; ++i) {
+        BatchJob job;
+        job.input = input_dir + "/" + names[i];
+        job.width = width;
+        job.height = height;
+        job.output = output_dir + "/" + names[i].substr(0, names[i].rfind('.')) + ".png";
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// State shared by the tasks of a batch.
+struct Batch
+{
+    mutex lock;
+    condition_variable released;        // An image left memory (run_batch only)
+    size_t in_flight;                   // Images read and not finished (run_batch only)
+    BatchStats stats;
+};
+
+// Data of an image going through the stages.
+struct BatchImage
+{
+    BatchJob job;
+    FlatRGBImage image;
+    CarvingState state;
+    size_t pixels;
+};
+
+// Reads the image of the job. Returns false (and reports it) if it can't be carved to the size of the job.
+static bool read_stage(Batch &batch, BatchImage &work)
+{
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    DecodedImage decoded;
+    if (decoded.open(work.job.input)) {
+        work.image = to_flat(decoded);
+    }
+    work.pixels = work.image.width * work.image.height;
+    {
+        lock_guard<mutex> lock(batch.lock);
+        batch.stats.read_seconds += seconds_since(start);
+    }
+    const BatchJob &job(work.job);
+    if (work.image.empty() || job.width == 0 || job.height == 0
+        || job.width > work.image.width || job.height > work.image.height) {
+        cout << "Error: " << job.input << " can't be carved to " << job.width << "x" << job.height << "." << endl;
+        return false;
+    }
+    return true;
+}
+
+static void energy_stage(Batch &batch, BatchImage &work)
+{
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    if (work.image.width > work.job.width) {
+        work.state = start_carving(work.image, false);
+    }
+    lock_guard<mutex> lock(batch.lock);
+    batch.stats.energy_seconds += seconds_since(start);
+}
+
+// Vertical seams with the state of energy_stage, then horizontal ones.
+static void carve_stage(Batch &batch, BatchImage &work)
+{
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    if (work.image.width > work.job.width) {
+        work.image = remove_seams(work.image, find_seams(work.state, work.image.width - work.job.width));
+        work.state = CarvingState();
+    }
+    if (work.image.height > work.job.height) {
+        work.image = carve_horizontal_seams(work.image, work.image.height - work.job.height);
+    }
+    lock_guard<mutex> lock(batch.lock);
+    batch.stats.carve_seconds += seconds_since(start);
+}
+
+// Returns false if the output can't be written (the image then counts as failed).
+static bool write_stage(Batch &batch, BatchImage &work)
+{
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    const bool written(write_image(to_nested(work.image), work.job.output));
+    work.image = FlatRGBImage();
+    lock_guard<mutex> lock(batch.lock);
+    batch.stats.write_seconds += seconds_since(start);
+    return written;
+}
+
+static void finish_image(Batch &batch, const BatchImage &work, bool written)
+{
+    lock_guard<mutex> lock(batch.lock);
+    if (written) {
+        ++batch.stats.images;
+        batch.stats.pixels += work.pixels;
+    } else {
+        ++batch.stats.failed;
+    }
+}
+
+// Lets run_batch read another image once one is finished.
+static void release_image(Batch &batch)
+{
+    lock_guard<mutex> lock(batch.lock);
+    --batch.in_flight;
+    batch.released.notify_one();
+}
+
+// Read, carve (energy and seams) and write are three tasks : while an image is carved,
+// the worker which read it may steal the reading of the next image, and so on.
+BatchStats run_batch(const vector<BatchJob> &jobs, size_t threads, size_t max_in_flight)
+{
+    ScopedTimer timer("run_batch");
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    Batch batch;
+    batch.in_flight = 0;
+    batch.stats = BatchStats();
+    max_in_flight = max(max_in_flight, size_t(1));
+    WorkStealingPool pool(threads);
+
+    for (size_t i(0) ; i < jobs.size() ; ++i) {
+        {
+            unique_lock<mutex> lock(batch.lock);
+            batch.released.wait(lock, [&]() { return batch.in_flight < max_in_flight; });
+            ++batch.in_flight;
+        }
+        shared_ptr<BatchImage> work(new BatchImage);
+        work->job = jobs[i];
+        pool.submit([&batch, &pool, work]() {
+            if (!read_stage(batch, *work)) {
+                finish_image(batch, *work, false);
+                release_image(batch);
+                return;
+            }
+            pool.submit([&batch, &pool, work]() {
+                energy_stage(batch, *work);
+                carve_stage(batch, *work);
+                pool.submit([&batch, work]() {
+                    finish_image(batch, *work, write_stage(batch, *work));
+                    release_image(batch);
+                });
+            });
+        });
+    }
+    pool.wait();
+    batch.stats.seconds = seconds_since(start);
+    return batch.stats;
+}
+
+BatchStats run_pipeline(const vector<BatchJob> &jobs, size_t queue_size)
+{
+    ScopedTimer timer("run_pipeline");
+    const chrono::steady_clock::time_point start(chrono::steady_clock::now());
+    Batch batch;
+    batch.in_flight = 0;                                            // Unused : the queues bound the images in memory
+    batch.stats = BatchStats();
+    BoundedQueue<shared_ptr<BatchImage>> read(queue_size), energy(queue_size), carved(queue_size);
+
+    thread reader([&]() {
+        for (size_t i(0) ; i < jobs.size() ; ++i) {
+            shared_ptr<BatchImage> work(new BatchImage);
+            work->job = jobs[i];
+            if (read_stage(batch, *work)) {
+                read.push(work);
+            } else {
+                finish_image(batch, *work, false);
+            }
+        }
+        read.close();
+    });
+    thread energy_computer([&]() {
+        shared_ptr<BatchImage> work;
+        while (read.pop(work)) {
+            energy_stage(batch, *work);
+            energy.push(work);
+        }
+        energy.close();
+    });
+    thread carver([&]() {
+        shared_ptr<BatchImage> work;
+        while (energy.pop(work)) {
+            carve_stage(batch, *work);
+            carved.push(work);
+        }
+        carved.close();
+    });
+
+    shared_ptr<BatchImage> work;                                    // The calling thread writes
+    while (carved.pop(work)) {
+        finish_image(batch, *work, write_stage(batch, *work));
+    }
+    reader.join();
+    energy_computer.join();
+    carver.join();
+    batch.stats.seconds = seconds_since(start);
+    return batch.stats;
+}
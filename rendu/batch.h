@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ * Carving of many images at once. A manifest lists one image per line :
+ *
+ *     # input             width  height  output
+ *     img/tower.jpg       500    400     out/tower.png
+ *
+ * Each image is read, carved down to width x height (vertical seams, then horizontal ones)
+ * and written as a png. The stages of different images run at the same time, either as tasks of
+ * a WorkStealingPool (run_batch) or on one thread per stage (run_pipeline).
+ */
+
+struct BatchJob
+{
+    std::string input;
+    size_t width;
+    size_t height;
+    std::string output;
+};
+
+struct BatchStats
+{
+    size_t images;              // Written successfully
+    size_t failed;
+    size_t pixels;              // Input pixels of the images written
+    double seconds;             // Wall time of the whole batch
+    double read_seconds;        // Time spent in each stage, summed over the threads
+    double energy_seconds;      // start_carving
+    double carve_seconds;
+    double write_seconds;
+};
+
+std::vector<BatchJob> read_manifest(const std::string &name);
+
+// Jobs carving all the jpg and png images of input_dir (in alphabetical order) to width x height,
+// written as png images with the same names in output_dir.
+std::vector<BatchJob> directory_jobs(const std::string &input_dir, const std::string &output_dir,
+                                     size_t width, size_t height);
+
+// Carves the jobs on threads threads, with at most max_in_flight images in memory at the same time.
+BatchStats run_batch(const std::vector<BatchJob> &jobs, size_t threads, size_t max_in_flight);
+
+// Runs the jobs through 4 stages, each on its own thread : read, energy (start_carving), carving and write.
+// A stage can be at most queue_size images ahead of the next one, so that reading and writing
+// (decompression and compression) overlap with carving without using much memory.
+BatchStats run_pipeline(const std::vector<BatchJob> &jobs, size_t queue_size);
@@ -0,0 +1,296 @@
+//
+//  benchmark.cpp
+//  SeamCarving
+//
+//  Times each stage of the pipeline on the images of res/img and on synthetic images,
+//  and checks the results against all the images of res/expected_outputs.
+//
+//  Usage:
+//      ./benchmark [res_path] [repetitions] [seams]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "extension.h"
+#include "fixed_point.h"
+#include "helper.h"
+#include "profiler.h"
+#include "pyramid.h"
+#include "seam.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Hides the "Info: ..." messages of read_image and write_image while timing.
+class QuietOutput
+{
+public:
+    QuietOutput() { cout.setstate(ios::failbit); }
+    ~QuietOutput() { cout.clear(); }
+};
+
+struct Timings
+{
+    vector<double> seconds;
+
+    double median() const { return percentile(0.5); }
+    double p95() const { return percentile(0.95); }
+
+    // Nearest-rank percentile
+    double percentile(double p) const
+    {
+        vector<double> sorted(seconds);
+        sort(sorted.begin(), sorted.end());
+        size_t rank(size_t(p * sorted.size() + 0.999999));
+        return sorted[min(max(rank, size_t(1)), sorted.size()) - 1];
+    }
+};
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs the stage repetitions times and prints its median / p95 time and throughput.
+template <typename Stage>
+static void run_stage(const string &image_name, const string &stage_name, size_t pixels, int repetitions, Stage stage)
+{
+    Timings timings;
+    for (int i(0); i < repetitions; ++i) {
+        QuietOutput quiet;
+        double start(now());
+        stage();
+        timings.seconds.push_back(now() - start);
+    }
+    const double megapixels(pixels / 1e6);
+    cout << left << setw(22) << image_name << setw(14) << stage_name << right << fixed
+         << setprecision(3) << setw(12) << timings.median() * 1e3
+         << setw(12) << timings.p95() * 1e3
+         << setprecision(1) << setw(12) << megapixels / timings.median() << endl;
+}
+
+// Deterministic synthetic image : gradients plus some texture, so that seams are not trivial.
+static RGBImage synthetic_image(size_t width, size_t height)
+{
+    RGBImage image(height, vector<int>(width));
+    for (size_t i(0); i < height; ++i) {
+        for (size_t j(0); j < width; ++j) {
+            unsigned hash((i * 73856093u) ^ (j * 19349663u));
+            int red((j * 255) / width);
+            int green((i * 255) / height);
+            int blue(((hash >> 7) & 0x3F) + (((i / 64 + j / 64) % 2) ? 128 : 0));
+            image[i][j] = (red << 16) | (green << 8) | blue;
+        }
+    }
+    return image;
+}
+
+static void benchmark_image(const string &name, const RGBImage &image, int repetitions, size_t seams, const string &encode_path)
+{
+    const size_t pixels(image.size() * image[0].size());
+    const FlatRGBImage flat(to_flat(image));
+    const FlatGrayImage gray(to_gray(flat));
+    const FlatGrayImage smoothed(smooth(gray));
+    const FlatGrayImage energy(sobel(smoothed));
+    const Path seam(find_seam(energy));
+
+    run_stage(name, "gray", pixels, repetitions, [&]() { to_gray(flat); });
+    run_stage(name, "smooth", pixels, repetitions, [&]() { smooth(gray); });
+    run_stage(name, "sobel", pixels, repetitions, [&]() { sobel(smoothed); });
+    run_stage(name, "fused_energy", pixels, repetitions, [&]() { fused_energy(gray); });
+    run_stage(name, "seam_search", pixels, repetitions, [&]() { find_seam(energy); });
+    run_stage(name, "seam_table", pixels, repetitions, [&]() { find_seam(energy, SEAM_FULL_TABLE); });
+    run_stage(name, "seam_forward", pixels, repetitions, [&]() { find_seam_forward(gray); });
+    run_stage(name, "seam_pyramid", pixels, repetitions, [&]() { find_seam_pyramid(energy); });
+    const ColumnWindow band(energy.height, energy.width / 2 - min(energy.width / 2, size_t(32)),
+                            min(energy.width / 2 + 31, energy.width - 1));         // 64 columns
+    run_stage(name, "seam_band", pixels, repetitions, [&]() { find_seam(energy, band); });
+    cout << left << setw(22) << name << setw(14) << "pyramid_dev" << right << fixed << setprecision(3)
+         << setw(12) << 100 * seam_energy_deviation(energy, find_seam_pyramid(energy)) << " % energy" << endl;
+    const FlatGray8Image gray8(to_gray8(flat));
+    const FlatEnergy16Image energy16(energy_fixed(gray8));
+    run_stage(name, "gray8", pixels, repetitions, [&]() { to_gray8(flat); });
+    run_stage(name, "energy_fixed", pixels, repetitions, [&]() { energy_fixed(gray8); });
+    run_stage(name, "seam_fixed", pixels, repetitions, [&]() { find_seam(energy16); });
+    run_stage(name, "seam_removal", pixels, repetitions, [&]() { remove_seam(flat, seam); });
+    run_stage(name, "encode", pixels, repetitions, [&]() { write_image(image, encode_path); });
+    run_stage(name, "carve_" + to_string(seams), pixels, repetitions, [&]() { carve_seams(flat, seams); });
+    run_stage(name, "carve_fwd_" + to_string(seams), pixels, repetitions, [&]() { carve_seams(flat, seams, ENERGY_FORWARD); });
+}
+
+// Compares an image with an expected output. Differences of 1 on a channel come from the rounding
+// of the gray values and are ignored. Apart from them, at most allowed_rows rows may differ : the
+// expected seams were computed with other floating point operations, which may swap two seams of
+// equal energy on a row, but a seam going another way differs on many rows.
+static bool check_output(const RGBImage &computed, const string &expected_path, size_t allowed_rows)
+{
+    RGBImage expected;
+    {
+        QuietOutput quiet;
+        expected = read_image(expected_path);
+    }
+    if (expected.empty() || expected.size() != computed.size() || expected[0].size() != computed[0].size()) {
+        cout << "[Failed] " << expected_path << " : missing file or different size" << endl;
+        return false;
+    }
+    size_t different(0), rows(0);
+    for (size_t i(0); i < expected.size(); ++i) {
+        const size_t before(different);
+        for (size_t j(0); j < expected[0].size(); ++j) {
+            for (int c(0); c < 3; ++c) {
+                int delta(((expected[i][j] >> (8 * c)) & 0xFF) - ((computed[i][j] >> (8 * c)) & 0xFF));
+                if (delta > 1 || delta < -1) {
+                    ++different;
+                    break;
+                }
+            }
+        }
+        rows += different > before;
+    }
+    const bool passed(rows <= allowed_rows);
+    cout << (passed ? "[Passed] " : "[Failed] ") << expected_path << " : " << different
+         << " different pixels on " << rows << " rows (allowed " << allowed_rows << " rows)" << endl;
+    return passed;
+}
+
+// Checks every file of res_path/expected_outputs, named image_operation.png : image is res/img/image.jpg
+// (or .png) and operation one of the test functions of main.cpp (grayed, smoothed, sobeled,
+// N_highlighted_seam or N_removed_seam).
+static bool check_expected_outputs(const string &res_path)
+{
+    const string directory(res_path + "/expected_outputs");
+    vector<string> names;
+#ifndef _WIN32
+    DIR *listing(opendir(directory.c_str()));
+    for (dirent *entry(listing ? readdir(listing) : nullptr) ; entry ; entry = readdir(listing)) {
+        const string name(entry->d_name);
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".png") == 0) {
+            names.push_back(name);
+        }
+    }
+    if (listing) {
+        closedir(listing);
+    }
+#endif
+    if (names.empty()) {
+        cout << "[Failed] no expected output in " << directory << endl;
+        return false;
+    }
+    sort(names.begin(), names.end());
+
+    bool passed(true);
+    for (const string &name : names) {
+        const string path(directory + "/" + name);
+        const size_t separator(name.find('_'));
+        const string operation(name.substr(separator + 1, name.size() - 4 - separator - 1));
+        RGBImage image;
+        {
+            QuietOutput quiet;
+            image = read_image(res_path + "/img/" + name.substr(0, separator) + ".jpg");
+            if (image.empty()) {
+                image = read_image(res_path + "/img/" + name.substr(0, separator) + ".png");
+            }
+        }
+        if (separator == string::npos || image.empty()) {
+            cout << "[Failed] " << path << " : no input image" << endl;
+            passed = false;
+            continue;
+        }
+        const GrayImage gray(to_gray(image));
+        const int seams(atoi(operation.c_str()));
+        const string kind(operation.substr(operation.find('_') + 1));
+        if (operation == "grayed") {
+            passed &= check_output(to_RGB(gray), path, 0);
+        } else if (operation == "smoothed") {
+            passed &= check_output(to_RGB(smooth(gray)), path, 0);
+        } else if (operation == "sobeled") {
+            passed &= check_output(to_RGB(sobel(gray)), path, 0);
+        } else if (seams > 0 && kind == "highlighted_seam") {
+            GrayImage highlighted(gray);
+            for (int i(0); i < seams; ++i) {
+                highlighted = highlight_seam(highlighted, find_seam(sobel(smooth(highlighted))));
+            }
+            passed &= check_output(to_RGB(highlighted), path, 2);
+        } else if (seams > 0 && kind == "removed_seam") {
+            passed &= check_output(to_nested(carve_seams(to_flat(image), seams)), path, 2);
+        } else {
+            cout << "[Failed] " << path << " : unknown operation " << operation << endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    const string res_path(argc > 1 ? argv[1] : "../res");
+    const int repetitions(argc > 2 ? atoi(argv[2]) : 5);
+    const size_t seams(argc > 3 ? atoi(argv[3]) : 50);
+    const string encode_path("benchmark_output.png");
+    if (repetitions < 1) {
+        cerr << "Usage:\n\t./benchmark [res_path] [repetitions] [seams]" << endl;
+        return -1;
+    }
+
+    // Set SEAM_PROFILE=file.json to get the detail of the stages as well
+    const char *profile_path(getenv("SEAM_PROFILE"));
+    set_profiling(profile_path != nullptr);
+
+    // Set SEAM_THREADS=n to choose the number of threads (one per core by default)
+    const char *threads(getenv("SEAM_THREADS"));
+    if (threads) {
+        set_thread_count(atoi(threads));
+    }
+    cout << "Threads: " << thread_count() << endl;
+
+    cout << "Checking results against " << res_path << "/expected_outputs" << endl;
+    const bool passed(check_expected_outputs(res_path));
+    cout << endl;
+
+    cout << left << setw(22) << "image" << setw(14) << "stage" << right << setw(12) << "median ms"
+         << setw(12) << "p95 ms" << setw(12) << "MP/s" << endl;
+
+    const char *images[] = {"americascup.jpg", "tower.jpg", "hiroshige.jpg"};
+    for (const char *name : images) {
+        const string path(res_path + "/img/" + name);
+        RGBImage image;
+        {
+            QuietOutput quiet;
+            image = read_image(path);                                   // Warm-up, checks the file
+        }
+        if (image.empty()) {
+            cout << "Error: can't read " << path << endl;
+            continue;
+        }
+        run_stage(name, "decode", image.size() * image[0].size(), repetitions, [&]() { read_image(path); });
+        run_stage(name, "decode_gray", image.size() * image[0].size(), repetitions, [&]() {
+            DecodedImage decoded;
+            decoded.open(path);
+            to_gray(decoded);
+        });
+        benchmark_image(name, image, repetitions, seams, encode_path);
+    }
+
+    const size_t sizes[] = {512, 1024, 2048};
+    for (size_t size : sizes) {
+        benchmark_image("synthetic_" + to_string(size) + "x" + to_string(size), synthetic_image(size, size),
+                        repetitions, seams, encode_path);
+    }
+    remove(encode_path.c_str());
+
+    if (profile_path) {
+        write_profile(profile_path);
+    }
+    return passed ? 0 : 1;
+}
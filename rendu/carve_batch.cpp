@@ -0,0 +1,61 @@
+//
+//  carve_batch.cpp
+//  SeamCarving
+//
+//  Carves all the images of a manifest, or of a directory, (see batch.h) and prints the throughput.
+//
+//  Usage:
+//      ./carve_batch manifest [threads] [max_in_flight]
+//      ./carve_batch --pipeline input_dir output_dir width height [queue_size]
+//
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "batch.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const bool pipeline(argc > 1 && std::string(argv[1]) == "--pipeline");
+    if (pipeline ? (argc < 6 || argc > 7) : (argc < 2 || argc > 4)) {
+        cerr << "Usage:\n\t./carve_batch manifest [threads] [max_in_flight]"
+             << "\n\t./carve_batch --pipeline input_dir output_dir width height [queue_size]" << endl;
+        return -1;
+    }
+
+    // Set SEAM_PROFILE=file.json to get the time spent in each stage
+    const char *profile_path(getenv("SEAM_PROFILE"));
+    set_profiling(profile_path != nullptr);
+
+    BatchStats stats;
+    if (pipeline) {
+        // One thread per stage, the stages themselves using the shared thread pool
+        const vector<BatchJob> jobs(directory_jobs(argv[2], argv[3], atoi(argv[4]), atoi(argv[5])));
+        stats = run_pipeline(jobs, argc > 6 ? atoi(argv[6]) : 2);
+    } else {
+        const size_t threads(argc > 2 ? atoi(argv[2]) : thread_count());
+        const size_t max_in_flight(argc > 3 ? atoi(argv[3]) : 2 * threads);
+
+        // The images are carved in parallel, each one by a single thread
+        set_thread_count(1);
+        stats = run_batch(read_manifest(argv[1]), threads, max_in_flight);
+    }
+
+    cout << "Images: " << stats.images << " carved, " << stats.failed << " failed, in " << stats.seconds << " s" << endl;
+    if (stats.seconds > 0) {
+        cout << "Throughput: " << stats.images / stats.seconds << " images/s, "
+             << stats.pixels / 1e6 / stats.seconds << " MP/s" << endl;
+    }
+    cout << "Time per stage (all threads): read " << stats.read_seconds << " s, energy " << stats.energy_seconds
+         << " s, carve " << stats.carve_seconds << " s, write " << stats.write_seconds << " s" << endl;
+
+    if (profile_path) {
+        write_profile(profile_path);
+    }
+    return stats.failed == 0 ? 0 : 1;
+}
@@ -1,7 +1,11 @@
 #include "extension.h"
+#include "fixed_kernel.h"
 #include "seam.h"
 #include "helper.h"
+#include "profiler.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <cmath>
 using namespace std;
 
 /* A UTILISER POUR LE CODAGE EVENTUEL D'EXTENSIONS */
@@ -26,106 +30,57 @@ return(id % width);
 // 2) Horizontal application of the algorithm
 // *******************************************
 
-// Create an horizontal graph instead, i.e. startId is on the left, and endId is on the right.
-Graph create_horizontal_graph(const GrayImage &gray)
-{
-    const long double INF(numeric_limits<double>::max());
-    const size_t hauteur(gray.size());
-    const size_t largeur(gray[0].size());
-    const size_t maxId((hauteur*largeur)-1);
-    const size_t startId(maxId + 1);                    // Calculating start and end ids from gray's size
-    const size_t endId(maxId + 2);
-    const size_t tailleId(endId+1);
-    
-    Graph graph(tailleId);                              
-    
-    for(size_t id(0); id < tailleId ; ++id) {
-        size_t row(get_row(id, largeur));               // Getting row and columns from id to deal with borderline cases
-        size_t col(get_col(id, largeur));
-        Path successors;
-        
-        if (id == startId){
-            graph[id].costs = 0;
-            for (size_t i(0); i < hauteur; ++i){                // Adding all ids from column 0 (instead of row 0) as successors of startId
-                successors.push_back(get_id(i, 0, largeur));
-            }
-            
-        } else if (id == endId){
-            graph[id].costs = 0;                                // No successors because in last position
-            
-        } else {
-            graph[id].costs = gray[row][col];
-        
-            if (col == largeur-1){                                          // If the node is in the last column (instead of row)
-                successors.push_back(endId);
-            } else if (row == 0){                                           // If the node is in the first row (instead of column)
-                successors.push_back(get_id(row, col+1, largeur));
-                successors.push_back(get_id(row+1, col+1, largeur));
-            } else if (row == hauteur-1){                                   // If the node is in the last row (instead of column)
-                successors.push_back(get_id(row-1, col+1, largeur));
-                successors.push_back(get_id(row, col+1, largeur));
-            } else {                                                        // Regular cases
-                successors.push_back(get_id(row-1, col+1, largeur));
-                successors.push_back(get_id(row, col+1, largeur));
-                successors.push_back(get_id(row+1, col+1, largeur));
-            }
-        }
-        graph[id].distance_to_target = INF;
-        graph[id].predecessor_to_target = 0;        // Properties common to all nodes
-        graph[id].successors = successors;
-    }
-    return graph;
-}
-
-// Return shortest path from Node from to Node to
-// The path does NOT include the from and to Node
-Path shortest_horizontal_path(Graph &graph, size_t from, size_t to)        // This fuction doesn't work (on Windows) without long doubles for costs and distance_to_target.
-{
-    Path pathfinder;
-                    
-    size_t startId(graph.size()-2);
-    if (to == startId){
-        return pathfinder;
-    }
-    
-    graph[from].distance_to_target = graph[from].costs;         // Beginning of Dijkstra's algorithm
-    bool modified(true);
-    while (modified) {
-        modified = false;
-        for (size_t i(0) ; i < graph.size() ; ++i) {
-            for (size_t j(0) ; j < (graph[i].successors).size() ; ++j) {
-                    size_t id((graph[i]).successors[j]);
-                if (graph[id].distance_to_target > graph[i].distance_to_target + (graph[id]).costs) {
-                    (graph[id].distance_to_target) = (graph[i].distance_to_target + (graph[id]).costs);
-                    (graph[id]).predecessor_to_target = i;
-                    modified = true;
-                    }
+// Horizontal seams are vertical seams of the transposed image : the vertical engine is reused as is,
+// and it reads the (transposed) rows sequentially instead of jumping a whole row at each step.
+
+// Copies image into its transpose by square blocks, so that both the rows read and the
+// rows written stay in the cache.
+template <typename T>
+static FlatImage<T> transpose_blocks(const FlatImage<T> &image)
+{
+    ScopedTimer timer("transpose");
+    const size_t BLOCK(32);
+    FlatImage<T> result(image.height, image.width);
+    for (size_t i0(0) ; i0 < image.height ; i0 += BLOCK) {
+        const size_t i1(min(i0 + BLOCK, image.height));
+        for (size_t j0(0) ; j0 < image.width ; j0 += BLOCK) {
+            const size_t j1(min(j0 + BLOCK, image.width));
+            for (size_t i(i0) ; i < i1 ; ++i) {
+                const T *source(image.row(i));
+                for (size_t j(j0) ; j < j1 ; ++j) {
+                    result(j, i) = source[j];
                 }
             }
         }
-
-    size_t index(to);
-    while (index != from){                              // Retrieving shortest path from the modified graph, using the bests predecessors
-        index = ((graph[index]).predecessor_to_target);
-        if (index != from) {
-            pathfinder.push_back(index);
-        }
     }
-    
-    reverse(pathfinder.begin(), pathfinder.end());        // As the path is found backwards, this loop puts it the right way
-    
-    return pathfinder;
+    return result;
 }
 
+FlatGrayImage transpose(const FlatGrayImage &gray)
+{
+    return transpose_blocks(gray);
+}
+
+FlatRGBImage transpose(const FlatRGBImage &image)
+{
+    return transpose_blocks(image);
+}
+
+// Returns, for each column, the row of the pixel of the best horizontal seam (from left to right).
 Path find_horizontal_seam(const GrayImage &gray)
 {
-    Graph graph (create_horizontal_graph(gray));                                           // Generate graph from gray image
-    Path pathseeker (shortest_horizontal_path(graph , graph.size()-2 , graph.size()-1));   // Finds the shortest path, from left (startId) to right (endId)
-    Path horizontal_seam;
-    for (size_t i(0) ; i < pathseeker.size() ; ++i ) {
-        horizontal_seam.push_back(get_row(pathseeker[i], gray[0].size()));                  // Computes rows for a path of ids to form the final seam
-    }
-    return horizontal_seam;
+    return find_horizontal_seam(to_flat(gray));
+}
+
+Path find_horizontal_seam(const FlatGrayImage &gray)
+{
+    return find_seam(transpose(gray));
+}
+
+// Removes num horizontal seams : the image is transposed once, carved with carve_seams and transposed back.
+FlatRGBImage carve_horizontal_seams(const FlatRGBImage &image, size_t num)
+{
+    return transpose(carve_seams(transpose(image), num));
 }
 
 
@@ -158,3 +113,354 @@ GrayImage highlight_horizontal_seam(const GrayImage &gray, const Path &seam)
     }
     return result;
 }
+
+
+// ***********************************************************
+// 3) Carving several seams while keeping the energy up to date
+// ***********************************************************
+
+// Computes the gray and energy maps once, before removing the first seam.
+// Without keep_image, only the maps are carved (the seams can be removed from the image later with remove_seams).
+CarvingState start_carving(const FlatRGBImage &image, bool keep_image)
+{
+    ScopedTimer timer("start_carving");
+    CarvingState state;
+    if (keep_image) {
+        state.image = image;
+    }
+    state.gray = to_gray(image);
+    state.energy = sobel(smooth(state.gray));
+    cumulative_energy(state.energy, state.cumulative, state.predecessors);
+    return state;
+}
+
+// Smallest and largest column of the seam between rows row-radius and row+radius (clamped to the image).
+static void seam_span(const Path &seam, size_t row, size_t radius, long &min_col, long &max_col)
+{
+    const size_t first(row < radius ? 0 : row-radius);
+    const size_t last(min(row+radius, seam.size()-1));
+    min_col = seam[first];
+    max_col = seam[first];
+    for (size_t i(first+1) ; i <= last ; ++i) {
+        min_col = min(min_col, long(seam[i]));
+        max_col = max(max_col, long(seam[i]));
+    }
+}
+
+// Columns of row whose energy has to be computed again after removing the seam (see update_energy).
+static void energy_band(const Path &seam, size_t row, long max_col, long &first, long &last)
+{
+    seam_span(seam, row, 2, first, last);
+    first = max(first-2, 0L);
+    last = min(last+1, max_col);
+}
+
+// Removes the pixel (row, col) of the map, shifting the end of the row to the left.
+template <typename T>
+static void erase_pixel(FlatImage<T> &map, size_t row, size_t col)
+{
+    T *line(map.row(row));
+    copy(line + col + 1, line + map.width, line + col);
+}
+
+// Removes the seam from the image (if kept) and from all the maps in a single pass over the rows,
+// each row of every map being shifted while the seam column is known. Used by carve_seam.
+static void remove_seam_from_state(CarvingState &state, const Path &seam)
+{
+    ScopedTimer timer("remove_seam_from_state");
+    const bool image(!state.image.empty());
+    parallel_rows(state.gray.height, 4 * state.gray.width, [&](size_t first, size_t last) {
+        for (size_t row(first) ; row < last ; ++row) {
+            if (image) {
+                erase_pixel(state.image, row, seam[row]);
+            }
+            erase_pixel(state.gray, row, seam[row]);
+            erase_pixel(state.energy, row, seam[row]);
+            erase_pixel(state.cumulative, row, seam[row]);
+            erase_pixel(state.predecessors, row, seam[row]);
+        }
+    });
+    if (image) {
+        --state.image.width;
+    }
+    --state.gray.width;
+    --state.energy.width;
+    --state.cumulative.width;
+    --state.predecessors.width;
+}
+
+// Computes again the energies of the pixels whose 5x5 neighbourhood contained the seam. Everywhere else,
+// the old values (shifted to the left on the right of the seam) are exactly the ones a full computation
+// would give. The smoothed pixels around each band (3 rows, clamped as filter_pixel does) are computed
+// from the gray levels in patch, so no smoothed map has to be kept and shifted.
+static void update_energy_band(CarvingState &state, const Path &seam)
+{
+    const size_t hauteur(state.gray.height);
+    const long max_col(long(state.gray.width)-1);
+    FlatGrayImage patch(state.gray.width + 2, 3);
+    long first, last;
+
+    for (size_t row(0) ; row < hauteur ; ++row) {                      // Energy band : columns [min-2, max+1] of the seam on 5 rows
+        energy_band(seam, row, max_col, first, last);
+        patch.width = last - first + 3;                                 // Columns first-1 to last+1
+        for (long k(0) ; k < 3 ; ++k) {
+            const long line(min(max(long(row)+k-1, 0L), long(hauteur)-1));
+            const bool inside_rows(line > 0 && line < long(hauteur)-1);
+            for (long col(first-1) ; col <= last+1 ; ++col) {
+                const long clamped(min(max(col, 0L), max_col));
+                if (inside_rows && clamped > 0 && clamped < max_col) {      // Same sum as filter_pixel, without the clamping
+                    InteriorTaps taps = {state.gray.row(line-1) + clamped-1, state.gray.stride, 0.0};
+                    SmoothKernel::apply(taps);
+                    patch(k, col-first+1) = taps.sum;
+                } else {
+                    patch(k, col-first+1) = filter_pixel<SmoothKernel>(state.gray, line, clamped);
+                }
+            }
+        }
+        for (long col(first) ; col <= last ; ++col) {
+            InteriorTaps x = {patch.row(0) + col-first, patch.stride, 0.0};
+            InteriorTaps y = {patch.row(0) + col-first, patch.stride, 0.0};
+            SobelXKernel::apply(x);
+            SobelYKernel::apply(y);
+            state.energy(row, col) = sqrt((x.sum*x.sum)+(y.sum*y.sum));     // Same formula as sobel
+        }
+    }
+}
+
+// Removes the seam from the image and the gray and energy maps, then recomputes only the energies
+// whose neighbourhood contained the seam (a smoothed pixel depends on the gray pixels of its 3x3
+// neighbourhood, an energy pixel on the 5x5 one).
+void update_energy(CarvingState &state, const Path &seam)
+{
+    ScopedTimer timer("update_energy");
+    if (!state.image.empty()) {
+        remove_seam_in_place(state.image, seam);
+    }
+    remove_seam_in_place(state.gray, seam);
+    remove_seam_in_place(state.energy, seam);
+    update_energy_band(state, seam);
+}
+
+// Computes again, row by row, the cumulative energies which can differ from the old (shifted) ones :
+// the energy band of update_energy, plus the successors of the pixels whose cumulative energy changed
+// in the previous row. Below the seam this cone usually dies out quickly, the pixels of the band being
+// the only ones left.
+static void update_cumulative_cone(CarvingState &state, const Path &seam)
+{
+    const size_t hauteur(state.energy.height);
+    const size_t largeur(state.energy.width);
+    const long max_col(long(largeur)-1);
+    long changed_first(0), changed_last(-1);                           // Columns changed in the previous row (empty range)
+    long first, last;
+    uint64_t pixels(0);                                                 // Counted once, at the end
+
+    for (size_t row(0) ; row < hauteur ; ++row) {
+        energy_band(seam, row, max_col, first, last);
+        if (changed_first <= changed_last) {
+            first = min(first, max(changed_first-1, 0L));
+            last = max(last, min(changed_last+1, max_col));
+        }
+        changed_first = max_col+1;
+        changed_last = -1;
+        const double *costs(state.energy.row(row));
+        const double *previous(row == 0 ? nullptr : state.cumulative.row(row-1));
+        double *current(state.cumulative.row(row));
+        signed char *offsets(state.predecessors.row(row));
+        for (long col(first) ; col <= last ; ++col) {
+            double distance(costs[col]);
+            if (row == 0) {
+                offsets[col] = 0;
+            } else if (col > 0 && col < max_col) {                      // Same comparisons as best_predecessor, inlined
+                const double *above(previous + col - 1);
+                signed char offset(-1);
+                distance = above[0] + costs[col];
+                if (above[1] + costs[col] < distance) {
+                    distance = above[1] + costs[col];
+                    offset = 0;
+                }
+                if (above[2] + costs[col] < distance) {
+                    distance = above[2] + costs[col];
+                    offset = 1;
+                }
+                offsets[col] = offset;
+            } else {
+                distance = best_predecessor(previous, largeur, col, costs[col], offsets[col]);
+            }
+            if (distance != current[col]) {
+                current[col] = distance;
+                changed_first = min(changed_first, col);
+                changed_last = max(changed_last, col);
+            }
+        }
+        pixels += last-first+1;
+    }
+    profile_count("update_cumulative_energy.pixels", pixels);
+}
+
+// Removes the seam from the cumulative energies, then updates the cone below it (see update_cumulative_cone).
+// Must be called after update_energy.
+void update_cumulative_energy(CarvingState &state, const Path &seam)
+{
+    ScopedTimer timer("update_cumulative_energy");
+    remove_seam_in_place(state.cumulative, seam);
+    remove_seam_in_place(state.predecessors, seam);
+    update_cumulative_cone(state, seam);
+}
+
+// Removes the best seam of the current image and updates the energy and cumulative energies.
+// Returns the removed seam (the one find_seam gives on state.energy).
+// Same as update_energy and update_cumulative_energy, but all the maps are shifted in a single pass.
+Path carve_seam(CarvingState &state)
+{
+    Path seam(backtrack_seam(state.cumulative.row(state.cumulative.height-1), state.predecessors));
+    remove_seam_from_state(state, seam);
+    {
+        ScopedTimer timer("update_energy");
+        update_energy_band(state, seam);
+    }
+    {
+        ScopedTimer timer("update_cumulative_energy");
+        update_cumulative_cone(state, seam);
+    }
+    return seam;
+}
+
+// Finds the num (at most width-1) best seams to remove one after the other, in original columns.
+// The forward energy is computed from the gray levels by each search, so only the gray image is kept up to date.
+SeamList find_seams(const FlatRGBImage &image, size_t num, EnergyKind energy)
+{
+    ScopedTimer timer("find_seams");
+    SeamList seams;
+    if (image.empty()) {
+        return seams;
+    }
+    if (energy == ENERGY_FORWARD) {
+        FlatGrayImage gray(to_gray(image));
+        for (size_t i(0) ; i < num && gray.width > 1 ; ++i) {
+            seams.push_back(find_seam_forward(gray));
+            remove_seam_in_place(gray, seams.back());
+        }
+        return to_original_coordinates(seams);
+    }
+    CarvingState state(start_carving(image, false));
+    return find_seams(state, num);
+}
+
+// Same as above, starting from a state computed by start_carving (which is carved by the seams).
+SeamList find_seams(CarvingState &state, size_t num)
+{
+    SeamList seams;
+    for (size_t i(0) ; i < num && state.gray.width > 1 ; ++i) {
+        seams.push_back(carve_seam(state));
+    }
+    return to_original_coordinates(seams);
+}
+
+// Removes num seams (at most width-1) from the image.
+// Gives the same result as computing to_gray (and smooth and sobel for ENERGY_SOBEL) again before each seam,
+// but the pixels of the image are copied only once, by remove_seams.
+FlatRGBImage carve_seams(const FlatRGBImage &image, size_t num, EnergyKind energy)
+{
+    return remove_seams(image, find_seams(image, num, energy));
+}
+
+
+// ***********************************************************
+// 4) Retargeting to any width with a seam index map
+// ***********************************************************
+
+// Carves the image once down to min_width and stores, for each pixel, the number of the seam which removed it.
+// Removing the seams one after the other always gives the same seams, so any width between min_width and
+// the original one can then be obtained without searching seams again (see retarget).
+SeamIndexMap build_index_map(const FlatRGBImage &image, size_t min_width, EnergyKind energy)
+{
+    ScopedTimer timer("build_index_map");
+    SeamIndexMap map;
+    map.width = image.width;
+    map.height = image.height;
+    map.direction = SEAM_VERTICAL;
+    map.energy = energy;
+    map.order = FlatImage<uint32_t>(image.width, image.height, NOT_REMOVED);
+
+    const size_t num(image.width > min_width ? image.width - min_width : 0);
+    SeamList seams(find_seams(image, num, energy));                             // In original columns
+    for (size_t k(0) ; k < seams.size() ; ++k) {
+        for (size_t row(0) ; row < image.height ; ++row) {
+            map.order(row, seams[k][row]) = k;
+        }
+    }
+    map.min_width = image.width - seams.size();
+    return map;
+}
+
+// Copies the pixels of a row whose removal order is at least removed, at most kept of them.
+// Returns false if the row doesn't keep exactly kept pixels (wrong orders in a corrupted map).
+template <typename T>
+static bool keep_pixels(const int *source, const T *order, size_t width, uint32_t removed, int *destination,
+                        size_t kept)
+{
+    size_t count(0);
+    for (size_t col(0) ; col < width ; ++col) {
+        if (order[col] >= removed) {
+            if (count == kept) {
+                return false;
+            }
+            destination[count++] = source[col];
+        }
+    }
+    return count == kept;
+}
+
+// Checks the sizes given to retarget. Returns false (and prints an error) if they don't fit.
+static bool check_retarget(const FlatRGBImage &image, size_t map_width, size_t map_height, size_t min_width,
+                           size_t width)
+{
+    if (image.width != map_width || image.height != map_height || width < min_width || width > map_width) {
+        cout << "Error: the index map doesn't fit the image or the width " << width << endl;
+        return false;
+    }
+    return true;
+}
+
+// Image of the given width (between map.min_width and map.width), keeping the pixels
+// which are not removed by the first map.width - width seams. Same result as carve_seams.
+// Returns an empty image if the map is corrupted (a row doesn't keep width pixels).
+FlatRGBImage retarget(const FlatRGBImage &image, const SeamIndexMap &map, size_t width)
+{
+    ScopedTimer timer("retarget");
+    if (!check_retarget(image, map.width, map.height, map.min_width, width)) {
+        return FlatRGBImage();
+    }
+    const uint32_t removed(map.width - width);
+
+    FlatRGBImage result(width, image.height);
+    for (size_t row(0) ; row < image.height ; ++row) {
+        if (!keep_pixels(image.row(row), map.order.row(row), image.width, removed, result.row(row), width)) {
+            cout << "Error: corrupted index map (row " << row << ")" << endl;
+            return FlatRGBImage();
+        }
+    }
+    return result;
+}
+
+// Same as above, reading the removal orders directly from a mapped index map file.
+FlatRGBImage retarget(const FlatRGBImage &image, const MappedIndexMap &map, size_t width)
+{
+    ScopedTimer timer("retarget");
+    if (!check_retarget(image, map.width(), map.height(), map.min_width(), width)) {
+        return FlatRGBImage();
+    }
+    const uint32_t removed(map.width() - width);
+
+    FlatRGBImage result(width, image.height);
+    for (size_t row(0) ; row < image.height ; ++row) {
+        const bool kept(map.order_bits() == 16
+                        ? keep_pixels(image.row(row), map.row16(row), image.width, removed, result.row(row), width)
+                        : keep_pixels(image.row(row), map.row32(row), image.width, removed, result.row(row), width));
+        if (!kept) {
+            cout << "Error: corrupted index map (row " << row << ")" << endl;
+            return FlatRGBImage();
+        }
+    }
+    return result;
+}
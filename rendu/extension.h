@@ -1,4 +1,7 @@
 #pragma once
+#include <stdint.h>
+
+#include "helper.h"
 #include "seam.h"
 #include "seam_types.h"
 
@@ -12,9 +15,36 @@ size_t get_col(size_t id , size_t width);
 
 // 2) Horizontal application of the algorithm //
 
-Graph create_horizontal_graph(const GrayImage &gray);
-Path shortest_horizontal_path(Graph &graph, size_t from, size_t to);
+FlatGrayImage transpose(const FlatGrayImage &gray);
+FlatRGBImage transpose(const FlatRGBImage &image);
 Path find_horizontal_seam(const GrayImage &gray);
+Path find_horizontal_seam(const FlatGrayImage &gray);
 
 void test_hightlight_horizontal_seam(std::string const& in_path, int num);
 GrayImage highlight_horizontal_seam(const GrayImage &gray, const Path &seam);
+
+// 3) Carving several seams while keeping the energy up to date //
+
+struct CarvingState
+{
+    FlatRGBImage image;
+    FlatGrayImage gray;
+    FlatGrayImage energy;       // sobel(smooth(gray))
+    FlatGrayImage cumulative;   // Cumulative minimum energy from the first row, see cumulative_energy
+    FlatOffsetImage predecessors;
+};
+
+CarvingState start_carving(const FlatRGBImage &image, bool keep_image = true);
+void update_energy(CarvingState &state, const Path &seam);
+void update_cumulative_energy(CarvingState &state, const Path &seam);
+Path carve_seam(CarvingState &state);
+SeamList find_seams(const FlatRGBImage &image, size_t num, EnergyKind energy = ENERGY_SOBEL);
+SeamList find_seams(CarvingState &state, size_t num);
+FlatRGBImage carve_seams(const FlatRGBImage &image, size_t num, EnergyKind energy = ENERGY_SOBEL);
+FlatRGBImage carve_horizontal_seams(const FlatRGBImage &image, size_t num);
+
+// 4) Retargeting to any width with a seam index map //
+
+SeamIndexMap build_index_map(const FlatRGBImage &image, size_t min_width, EnergyKind energy = ENERGY_SOBEL);
+FlatRGBImage retarget(const FlatRGBImage &image, const SeamIndexMap &map, size_t width);
+FlatRGBImage retarget(const FlatRGBImage &image, const MappedIndexMap &map, size_t width);
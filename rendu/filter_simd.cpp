@@ -0,0 +1,219 @@
+#include "filter_simd.h"
+#include "seam.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEAM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static bool simd_enabled(true);
+
+// Best instruction set of the processor running the program.
+SimdLevel simd_level()
+{
+#ifdef SEAM_X86_SIMD
+    static const SimdLevel level(__builtin_cpu_supports("avx2") ? SIMD_AVX2 :
+                                 __builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_NONE);
+    return simd_enabled ? level : SIMD_NONE;
+#else
+    return SIMD_NONE;
+#endif
+}
+
+// Allows to force the scalar code (to compare both versions).
+void set_simd_enabled(bool enabled)
+{
+    simd_enabled = enabled;
+}
+
+#ifdef SEAM_X86_SIMD
+
+// Each vector lane does the same operations as filter_pixel, in the same order
+// (products added one by one, kernel row after kernel row), so the results are identical.
+// Multiplications and additions are kept separate (no fused multiply-add) for the same reason.
+
+__attribute__((target("avx2")))
+static void interior_avx2(const FlatGrayImage &gray, const Kernel &kernel, FlatGrayImage &filtered,
+                          size_t first_row, size_t last_row)
+{
+    const size_t taille(kernel.size());
+    const size_t demi(taille / 2);
+    const size_t last_col(gray.width - demi);
+
+    for (size_t i(first_row) ; i < last_row ; ++i) {
+        double *line(filtered.row(i));
+        size_t j(demi);
+        for ( ; j + 4 <= last_col ; j += 4) {                          // 4 pixels at once
+            __m256d somme(_mm256_setzero_pd());
+            for (size_t k(0) ; k < taille ; ++k) {
+                const double *source(gray.row(i + k - demi) + j - demi);
+                for (size_t c(0) ; c < taille ; ++c) {
+                    somme = _mm256_add_pd(somme, _mm256_mul_pd(_mm256_set1_pd(kernel[k][c]), _mm256_loadu_pd(source + c)));
+                }
+            }
+            _mm256_storeu_pd(line + j, somme);
+        }
+        for ( ; j < last_col ; ++j) {                                   // Remaining pixels of the row
+            line[j] = filter_pixel(gray, kernel, i, j);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void interior_sse2(const FlatGrayImage &gray, const Kernel &kernel, FlatGrayImage &filtered,
+                          size_t first_row, size_t last_row)
+{
+    const size_t taille(kernel.size());
+    const size_t demi(taille / 2);
+    const size_t last_col(gray.width - demi);
+
+    for (size_t i(first_row) ; i < last_row ; ++i) {
+        double *line(filtered.row(i));
+        size_t j(demi);
+        for ( ; j + 2 <= last_col ; j += 2) {                          // 2 pixels at once
+            __m128d somme(_mm_setzero_pd());
+            for (size_t k(0) ; k < taille ; ++k) {
+                const double *source(gray.row(i + k - demi) + j - demi);
+                for (size_t c(0) ; c < taille ; ++c) {
+                    somme = _mm_add_pd(somme, _mm_mul_pd(_mm_set1_pd(kernel[k][c]), _mm_loadu_pd(source + c)));
+                }
+            }
+            _mm_storeu_pd(line + j, somme);
+        }
+        for ( ; j < last_col ; ++j) {
+            line[j] = filter_pixel(gray, kernel, i, j);
+        }
+    }
+}
+
+// Forward energy, 4 (AVX2) or 2 (SSE2) columns at once. Each lane computes the costs of forward_costs
+// with the same operations (the absolute value clears the sign bit, as fabs) and keeps the best
+// predecessor with the same strict comparisons, left, middle then right.
+
+// Offsets of 4 lanes for the masks of the comparisons (middle better | right better << 4),
+// so that the offsets are stored without a branch per lane.
+struct ForwardOffsets
+{
+    signed char lanes[256][4];
+
+    ForwardOffsets()
+    {
+        for (int masks(0) ; masks < 256 ; ++masks) {
+            for (int k(0) ; k < 4 ; ++k) {
+                lanes[masks][k] = (masks >> (k+4)) & 1 ? 1 : (masks >> k) & 1 ? 0 : -1;
+            }
+        }
+    }
+};
+
+static const ForwardOffsets forward_offsets;
+
+__attribute__((target("avx2")))
+static size_t forward_avx2(const double *up, const double *line, const double *previous, double *current,
+                           signed char *offsets, size_t first, size_t last)
+{
+    const __m256d sign(_mm256_set1_pd(-0.0));
+    size_t col(first);
+    for ( ; col + 4 <= last ; col += 4) {
+        const __m256d left(_mm256_loadu_pd(line + col - 1));
+        const __m256d right(_mm256_loadu_pd(line + col + 1));
+        const __m256d above(_mm256_loadu_pd(up + col));
+        const __m256d middle(_mm256_andnot_pd(sign, _mm256_sub_pd(right, left)));
+        const __m256d from_left(_mm256_add_pd(_mm256_loadu_pd(previous + col - 1),
+                                              _mm256_add_pd(middle, _mm256_andnot_pd(sign, _mm256_sub_pd(above, left)))));
+        const __m256d from_middle(_mm256_add_pd(_mm256_loadu_pd(previous + col), middle));
+        const __m256d from_right(_mm256_add_pd(_mm256_loadu_pd(previous + col + 1),
+                                               _mm256_add_pd(middle, _mm256_andnot_pd(sign, _mm256_sub_pd(above, right)))));
+        const __m256d middle_better(_mm256_cmp_pd(from_middle, from_left, _CMP_LT_OQ));
+        __m256d best(_mm256_blendv_pd(from_left, from_middle, middle_better));
+        const __m256d right_better(_mm256_cmp_pd(from_right, best, _CMP_LT_OQ));
+        best = _mm256_blendv_pd(best, from_right, right_better);
+        _mm256_storeu_pd(current + col, best);
+
+        const int masks(_mm256_movemask_pd(middle_better) | _mm256_movemask_pd(right_better) << 4);
+        copy(forward_offsets.lanes[masks], forward_offsets.lanes[masks] + 4, offsets + col - first);
+    }
+    return col;
+}
+
+__attribute__((target("sse2")))
+static size_t forward_sse2(const double *up, const double *line, const double *previous, double *current,
+                           signed char *offsets, size_t first, size_t last)
+{
+    const __m128d sign(_mm_set1_pd(-0.0));
+    size_t col(first);
+    for ( ; col + 2 <= last ; col += 2) {
+        const __m128d left(_mm_loadu_pd(line + col - 1));
+        const __m128d right(_mm_loadu_pd(line + col + 1));
+        const __m128d above(_mm_loadu_pd(up + col));
+        const __m128d middle(_mm_andnot_pd(sign, _mm_sub_pd(right, left)));
+        const __m128d from_left(_mm_add_pd(_mm_loadu_pd(previous + col - 1),
+                                           _mm_add_pd(middle, _mm_andnot_pd(sign, _mm_sub_pd(above, left)))));
+        const __m128d from_middle(_mm_add_pd(_mm_loadu_pd(previous + col), middle));
+        const __m128d from_right(_mm_add_pd(_mm_loadu_pd(previous + col + 1),
+                                            _mm_add_pd(middle, _mm_andnot_pd(sign, _mm_sub_pd(above, right)))));
+        const __m128d middle_better(_mm_cmplt_pd(from_middle, from_left));
+        __m128d best(_mm_or_pd(_mm_and_pd(middle_better, from_middle), _mm_andnot_pd(middle_better, from_left)));
+        const __m128d right_better(_mm_cmplt_pd(from_right, best));
+        best = _mm_or_pd(_mm_and_pd(right_better, from_right), _mm_andnot_pd(right_better, best));
+        _mm_storeu_pd(current + col, best);
+
+        const int masks(_mm_movemask_pd(middle_better) | _mm_movemask_pd(right_better) << 4);
+        copy(forward_offsets.lanes[masks], forward_offsets.lanes[masks] + 2, offsets + col - first);
+    }
+    return col;
+}
+
+#endif
+
+size_t forward_row(const double *up, const double *line, const double *previous, double *current,
+                   signed char *offsets, size_t first, size_t last)
+{
+    switch (simd_level()) {
+#ifdef SEAM_X86_SIMD
+        case SIMD_AVX2:
+            return forward_avx2(up, line, previous, current, offsets, first, last);
+        case SIMD_SSE2:
+            return forward_sse2(up, line, previous, current, offsets, first, last);
+#endif
+        default:
+            return first;
+    }
+}
+
+// Fills the interior of filtered (rows and columns at least kernel.size()/2 away from the borders)
+// between the rows first_row and last_row (excluded) with a vectorized convolution.
+// Returns false when nothing was done : kernel other than 3x3 or 5x5, image too small,
+// or no vector instructions available. The borders are left to the caller.
+bool filter_interior(const FlatGrayImage &gray, const Kernel &kernel, FlatGrayImage &filtered,
+                     size_t first_row, size_t last_row)
+{
+    const size_t taille(kernel.size());
+    if ((taille != 3 && taille != 5) || gray.width < taille || gray.height < taille) {
+        return false;
+    }
+    for (size_t k(0) ; k < taille ; ++k) {
+        if (kernel[k].size() != taille) {
+            return false;
+        }
+    }
+    first_row = max(first_row, taille / 2);
+    last_row = min(last_row, gray.height - taille / 2);
+
+    switch (simd_level()) {
+#ifdef SEAM_X86_SIMD
+        case SIMD_AVX2:
+            interior_avx2(gray, kernel, filtered, first_row, last_row);
+            return true;
+        case SIMD_SSE2:
+            interior_sse2(gray, kernel, filtered, first_row, last_row);
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "seam_types.h"
+
+// Vectorized convolution of the interior of an image (pixels whose whole neighbourhood is inside
+// the image), used by filter for 3x3 and 5x5 kernels, on the rows [first_row, last_row).
+// The instruction set is chosen at runtime.
+
+enum SimdLevel { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+
+SimdLevel simd_level();
+void set_simd_enabled(bool enabled);
+
+bool filter_interior(const FlatGrayImage &gray, const Kernel &kernel, FlatGrayImage &filtered,
+                     size_t first_row, size_t last_row);
+
+// Forward energy relaxation (see find_seam_forward) of the columns [first, last) of a row, with
+// 1 <= first and last <= width-1 : up and line are the gray levels of the previous row and of the row,
+// previous the cumulative energies of the previous row, offsets[0] the offset of column first.
+// Returns the first column not computed (first without vector instructions), the others being left to the caller.
+size_t forward_row(const double *up, const double *line, const double *previous, double *current,
+                   signed char *offsets, size_t first, size_t last);
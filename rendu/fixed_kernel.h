@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstddef>
+
+#include "filter_simd.h"
+#include "profiler.h"
+#include "seam.h"
+#include "seam_types.h"
+#include "thread_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEAM_FIXED_KERNEL_SIMD
+#include <immintrin.h>
+#endif
+
+// The taps must be expanded into the function filtering the pixels, which may be compiled
+// for other instructions (filter_row_avx2) : the compiler can't inline the op into apply itself.
+#ifdef __GNUC__
+#define SEAM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define SEAM_ALWAYS_INLINE inline
+#endif
+
+/*
+ * Kernels known at compile time : the weights are template parameters, divided by Denominator.
+ *
+ *     typedef FixedKernel<10, 1, 1, 1,
+ *                             1, 2, 1,
+ *                             1, 1, 1> SmoothKernel;
+ *     FlatGrayImage smoothed(filter<SmoothKernel>(gray));
+ *
+ * The taps are expanded by the compiler (no loop over the kernel, no vector of vectors) and the
+ * zero ones are dropped. The other taps are applied in the same order and with the same coefficients
+ * (Weight / Denominator is the double nearest to the decimal weight) as filter with the equivalent Kernel,
+ * so the results are the same, except maybe the sign of zero results.
+ * filter(gray, kernel) stays for kernels known at runtime.
+ */
+
+constexpr size_t kernel_side(size_t taps, size_t side = 1)
+{
+    return side * side >= taps ? side : kernel_side(taps, side + 2);
+}
+
+// Calls op(row, col, coefficient) for each non zero tap, row by row.
+template <size_t Size, size_t Index, int Denominator, int... Weights>
+struct KernelTaps
+{
+    template <typename Op>
+    static SEAM_ALWAYS_INLINE void apply(Op &) {}
+};
+
+template <size_t Size, size_t Index, int Denominator, int Weight, int... Rest>
+struct KernelTaps<Size, Index, Denominator, Weight, Rest...>
+{
+    template <typename Op>
+    static SEAM_ALWAYS_INLINE void apply(Op &op)
+    {
+        if (Weight != 0) {
+            op(Index / Size, Index % Size, double(Weight) / Denominator);
+        }
+        KernelTaps<Size, Index + 1, Denominator, Rest...>::apply(op);
+    }
+};
+
+template <int Denominator, int... Weights>
+struct FixedKernel
+{
+    static constexpr size_t size = kernel_side(sizeof...(Weights));
+    static_assert(size * size == sizeof...(Weights), "A fixed kernel has size x size weights, size being odd");
+
+    template <typename Op>
+    static SEAM_ALWAYS_INLINE void apply(Op &op)
+    {
+        KernelTaps<size, 0, Denominator, Weights...>::apply(op);
+    }
+
+    // Equivalent runtime kernel
+    static Kernel runtime()
+    {
+        const int weights[] = {Weights...};
+        Kernel kernel(size, std::vector<double>(size));
+        for (size_t k(0) ; k < size * size ; ++k) {
+            kernel[k / size][k % size] = double(weights[k]) / Denominator;
+        }
+        return kernel;
+    }
+};
+
+typedef FixedKernel<10, 1, 1, 1,
+                        1, 2, 1,
+                        1, 1, 1> SmoothKernel;
+
+typedef FixedKernel<1, -1, 0, 1,
+                       -2, 0, 2,
+                       -1, 0, 1> SobelXKernel;
+
+typedef FixedKernel<1, -1, -2, -1,
+                        0,  0,  0,
+                        1,  2,  1> SobelYKernel;
+
+// Accumulates the taps around (row, col), the borders being handled by taking the nearest valid pixel.
+struct ClampedTaps
+{
+    const FlatGrayImage &gray;
+    long row, col, demi;
+    double sum;
+
+    void operator()(size_t k, size_t c, double coefficient)
+    {
+        long index1(row + long(k) - demi);
+        long index2(col + long(c) - demi);
+        clamp(index1, long(gray.height) - 1);
+        clamp(index2, long(gray.width) - 1);
+        sum += coefficient * gray.row(index1)[index2];
+    }
+};
+
+template <typename K>
+double filter_pixel(const FlatGrayImage &gray, size_t row, size_t col)
+{
+    ClampedTaps taps = {gray, long(row), long(col), long(K::size / 2), 0.0};
+    K::apply(taps);
+    return taps.sum;
+}
+
+// Same without the clamping, for pixels whose whole neighbourhood is inside the image.
+struct InteriorTaps
+{
+    const double *source;           // Top left pixel of the neighbourhood
+    size_t stride;
+    double sum;
+
+    void operator()(size_t k, size_t c, double coefficient)
+    {
+        sum += coefficient * source[k * stride + c];
+    }
+};
+
+#ifdef SEAM_FIXED_KERNEL_SIMD
+
+// 4 (AVX2) or 2 (SSE2) neighbouring pixels at once, each lane doing the operations of InteriorTaps.
+struct InteriorTapsAVX2
+{
+    const double *source;
+    size_t stride;
+    __m256d sum;
+
+    __attribute__((target("avx2"))) void operator()(size_t k, size_t c, double coefficient)
+    {
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(coefficient), _mm256_loadu_pd(source + k * stride + c)));
+    }
+};
+
+struct InteriorTapsSSE2
+{
+    const double *source;
+    size_t stride;
+    __m128d sum;
+
+    __attribute__((target("sse2"))) void operator()(size_t k, size_t c, double coefficient)
+    {
+        sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(coefficient), _mm_loadu_pd(source + k * stride + c)));
+    }
+};
+
+template <typename K>
+__attribute__((target("avx2"))) size_t filter_row_avx2(const FlatGrayImage &gray, size_t i, size_t j, size_t last_col, double *line)
+{
+    const size_t demi(K::size / 2);
+    for ( ; j + 4 <= last_col ; j += 4) {
+        InteriorTapsAVX2 taps = {gray.row(i - demi) + j - demi, gray.stride, _mm256_setzero_pd()};
+        K::apply(taps);
+        _mm256_storeu_pd(line + j, taps.sum);
+    }
+    return j;
+}
+
+template <typename K>
+__attribute__((target("sse2"))) size_t filter_row_sse2(const FlatGrayImage &gray, size_t i, size_t j, size_t last_col, double *line)
+{
+    const size_t demi(K::size / 2);
+    for ( ; j + 2 <= last_col ; j += 2) {
+        InteriorTapsSSE2 taps = {gray.row(i - demi) + j - demi, gray.stride, _mm_setzero_pd()};
+        K::apply(taps);
+        _mm_storeu_pd(line + j, taps.sum);
+    }
+    return j;
+}
+
+#endif
+
+// Convolution with a kernel known at compile time, by bands of rows computed in parallel.
+template <typename K>
+FlatGrayImage filter(const FlatGrayImage &gray)
+{
+    ScopedTimer timer("filter");
+    FlatGrayImage filtered(gray.width, gray.height);
+    const size_t demi(K::size / 2);
+    const SimdLevel level(simd_level());
+    (void)level;                                                        // Unused without vector instructions
+
+    parallel_rows(gray.height, gray.width, [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            double *line(filtered.row(i));
+            if (i < demi || i + demi >= gray.height || gray.width <= 2 * demi) {
+                for (size_t j(0) ; j < gray.width ; ++j) {              // Border row
+                    line[j] = filter_pixel<K>(gray, i, j);
+                }
+                continue;
+            }
+            for (size_t j(0) ; j < demi ; ++j) {                        // Left and right borders
+                line[j] = filter_pixel<K>(gray, i, j);
+                line[gray.width - 1 - j] = filter_pixel<K>(gray, i, gray.width - 1 - j);
+            }
+            const size_t last_col(gray.width - demi);
+            size_t j(demi);
+#ifdef SEAM_FIXED_KERNEL_SIMD
+            if (level == SIMD_AVX2) {
+                j = filter_row_avx2<K>(gray, i, j, last_col, line);
+            } else if (level == SIMD_SSE2) {
+                j = filter_row_sse2<K>(gray, i, j, last_col, line);
+            }
+#endif
+            for ( ; j < last_col ; ++j) {
+                InteriorTaps taps = {gray.row(i - demi) + j - demi, gray.stride, 0.0};
+                K::apply(taps);
+                line[j] = taps.sum;
+            }
+        }
+    });
+    return filtered;
+}
@@ -0,0 +1,163 @@
+#include "fixed_point.h"
+#include "helper.h"
+#include "profiler.h"
+#include "seam.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Square root rounded down. The square root of a double is correctly rounded everywhere (IEEE 754),
+// and for a 32 bits value it is never rounded up to the next integer, so the result is exact ;
+// the checks only guard against a non conforming sqrt. Much faster than a digit by digit root.
+uint32_t isqrt(uint32_t value)
+{
+    uint64_t root(sqrt(double(value)));
+    while (root * root > value) {
+        --root;
+    }
+    while ((root + 1) * (root + 1) <= value) {
+        ++root;
+    }
+    return uint32_t(root);
+}
+
+FlatGray8Image to_gray8(const FlatRGBImage &image)
+{
+    ScopedTimer timer("to_gray8");
+    FlatGray8Image gray(image.width, image.height);
+    parallel_rows(image.height, image.width, [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            const int *line(image.row(i));
+            uint8_t *grline(gray.row(i));
+            for (size_t j(0) ; j < image.width ; ++j) {
+                const int sum(((line[j] >> 16) & 0xFF) + ((line[j] >> 8) & 0xFF) + (line[j] & 0xFF));
+                grline[j] = (sum + 1) / 3;                              // Rounded average
+            }
+        }
+    });
+    return gray;
+}
+
+FlatGray8Image to_gray8(const DecodedImage &image)
+{
+    ScopedTimer timer("to_gray8");
+    FlatGray8Image gray(image.width(), image.height());
+    parallel_rows(image.height(), image.width(), [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            const uint8_t *source(image.row(i));
+            uint8_t *grline(gray.row(i));
+            for (size_t j(0) ; j < image.width() ; ++j, source += 3) {
+                grline[j] = (source[0] + source[1] + source[2] + 1) / 3;
+            }
+        }
+    });
+    return gray;
+}
+
+// Rows of the neighbourhood of row, clamped to the image like in filter_pixel.
+template <typename T>
+static void neighbour_rows(const FlatImage<T> &image, size_t row, const T *&above, const T *&line, const T *&below)
+{
+    above = image.row(row == 0 ? 0 : row-1);
+    line = image.row(row);
+    below = image.row(row+1 == image.height ? row : row+1);
+}
+
+// 10 x smooth : the kernel is the 3x3 box plus the center, computed as a vertical then an horizontal sum.
+FlatEnergy16Image smooth_fixed(const FlatGray8Image &gray)
+{
+    ScopedTimer timer("smooth_fixed");
+    FlatEnergy16Image smoothed(gray.width, gray.height);
+    if (gray.empty()) {
+        return smoothed;
+    }
+    const size_t largeur(gray.width);
+    parallel_rows(gray.height, largeur, [&](size_t first, size_t last) {
+        vector<uint16_t> column(largeur + 2);                           // Vertical sums, with the clamped borders
+        for (size_t i(first) ; i < last ; ++i) {
+            const uint8_t *above, *line, *below;
+            neighbour_rows(gray, i, above, line, below);
+            for (size_t j(0) ; j < largeur ; ++j) {
+                column[j+1] = above[j] + line[j] + below[j];
+            }
+            column[0] = column[1];
+            column[largeur+1] = column[largeur];
+            uint16_t *out(smoothed.row(i));
+            for (size_t j(0) ; j < largeur ; ++j) {
+                out[j] = column[j] + column[j+1] + column[j+2] + line[j];
+            }
+        }
+    });
+    return smoothed;
+}
+
+// Largest smoothed value sobel_fixed accepts : smooth_fixed gives at most 10 x 255 = 2550. Not checked
+// per pixel, so that the inner loops stay free of branches (and vectorizable).
+static const uint32_t MAX_SMOOTHED(4095);
+static_assert(10 * 255 <= MAX_SMOOTHED, "smooth_fixed values must be accepted by sobel_fixed");
+static_assert(2 * (4 * MAX_SMOOTHED) * (4 * MAX_SMOOTHED) <= 0xFFFFFFFFu, "sobel_fixed squares must fit on 32 bits");
+
+// Both Sobel kernels as a vertical then an horizontal pass ((1,2,1) x (-1,0,1) and (-1,0,1) x (1,2,1)),
+// the zero taps being skipped. With values up to MAX_SMOOTHED, the squares fit on 32 bits.
+FlatEnergy16Image sobel_fixed(const FlatEnergy16Image &smoothed)
+{
+    ScopedTimer timer("sobel_fixed");
+    FlatEnergy16Image energy(smoothed.width, smoothed.height);
+    if (smoothed.empty()) {
+        return energy;
+    }
+    const size_t largeur(smoothed.width);
+    parallel_rows(smoothed.height, largeur, [&](size_t first, size_t last) {
+        vector<int32_t> vertical_x(largeur + 2), vertical_y(largeur + 2);
+        for (size_t i(first) ; i < last ; ++i) {
+            const uint16_t *above, *line, *below;
+            neighbour_rows(smoothed, i, above, line, below);
+            for (size_t j(0) ; j < largeur ; ++j) {
+                vertical_x[j+1] = above[j] + 2*line[j] + below[j];
+                vertical_y[j+1] = below[j] - above[j];
+            }
+            vertical_x[0] = vertical_x[1];
+            vertical_y[0] = vertical_y[1];
+            vertical_x[largeur+1] = vertical_x[largeur];
+            vertical_y[largeur+1] = vertical_y[largeur];
+            uint16_t *out(energy.row(i));
+            for (size_t j(0) ; j < largeur ; ++j) {
+                const int32_t x(vertical_x[j+2] - vertical_x[j]);
+                const int32_t y(vertical_y[j] + 2*vertical_y[j+1] + vertical_y[j+2]);
+                out[j] = isqrt(uint32_t(x*x) + uint32_t(y*y));
+            }
+        }
+    });
+    return energy;
+}
+
+FlatEnergy16Image energy_fixed(const FlatGray8Image &gray)
+{
+    return sobel_fixed(smooth_fixed(gray));
+}
+
+// Finds the num (at most width-1) best seams to remove one after the other with the integer energy,
+// in original columns. The energy is computed again on the whole carved image before each seam.
+SeamList find_seams_fixed(const FlatRGBImage &image, size_t num)
+{
+    ScopedTimer timer("find_seams_fixed");
+    SeamList seams;
+    if (image.empty()) {
+        return seams;
+    }
+    FlatGray8Image gray(to_gray8(image));
+    for (size_t i(0) ; i < num && gray.width > 1 ; ++i) {
+        seams.push_back(find_seam(energy_fixed(gray)));
+        remove_seam_in_place(gray, seams.back());
+    }
+    return to_original_coordinates(seams);
+}
+
+FlatRGBImage carve_seams_fixed(const FlatRGBImage &image, size_t num)
+{
+    return remove_seams(image, find_seams_fixed(image, num));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "seam_types.h"
+
+class DecodedImage;
+
+/*
+ * Integer version of the energy : sobel(smooth(gray)) computed with exact integer kernels.
+ *
+ *     gray8          0 - 255               average of red, green and blue, rounded
+ *     smooth_fixed   0 - 2550              10 x smooth (weights 1 1 1 / 1 2 1 / 1 1 1)
+ *     sobel_fixed    0 - 14424             square root (rounded down) of sobelX^2 + sobelY^2
+ *
+ * The energies are about 2550 times the double ones, and find_seam(FlatEnergy16Image) adds them
+ * exactly on 32 bits : the seams are the same on every compiler and processor. Each pixel takes 1
+ * or 2 bytes instead of 8, and the loops work on small integers, which vectorize well.
+ */
+
+uint32_t isqrt(uint32_t value);
+
+FlatGray8Image to_gray8(const FlatRGBImage &image);
+FlatGray8Image to_gray8(const DecodedImage &image);
+FlatEnergy16Image smooth_fixed(const FlatGray8Image &gray);
+FlatEnergy16Image sobel_fixed(const FlatEnergy16Image &smoothed);        // Values of smoothed at most 4095
+FlatEnergy16Image energy_fixed(const FlatGray8Image &gray);
+
+SeamList find_seams_fixed(const FlatRGBImage &image, size_t num);
+FlatRGBImage carve_seams_fixed(const FlatRGBImage &image, size_t num);
@@ -1,4 +1,5 @@
 #include "helper.h"
+#include "profiler.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -8,6 +9,17 @@
 
 #define CHANNEL_NUM 3
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 bool exists(const std::string &name)
 {
     std::ifstream f(name.c_str());
@@ -20,21 +32,16 @@ bool exists(const std::string &name)
  */
 RGBImage read_image(std::string name)
 {
-    int width, height, bpp;
-
-    if (!exists(name)) {
-        std::cout << "Error: File " << name << " does not exist." << std::endl;
+    ScopedTimer timer("read_image");
+    DecodedImage decoded;
+    if (!decoded.open(name)) {
         return std::vector<std::vector<int>>();
     }
+    std::vector<std::vector<int>> image = std::vector<std::vector<int>>(decoded.height(), std::vector<int>(decoded.width()));
 
-    std::cout << "Info: reading file " << name << std::endl;
-
-    uint8_t *rgb_image = stbi_load(name.c_str(), &width, &height, &bpp, CHANNEL_NUM);
-    std::vector<std::vector<int>> image = std::vector<std::vector<int>>(height, std::vector<int>(width));
-
-    uint8_t *iterator = rgb_image;
-    for (size_t i(0); i < height; ++i) {
-        for (size_t j(0); j < width; ++j) {
+    for (size_t i(0); i < decoded.height(); ++i) {
+        const uint8_t *iterator = decoded.row(i);
+        for (size_t j(0); j < decoded.width(); ++j) {
             int rgb = 0;
             for (int c(CHANNEL_NUM - 1); c >= 0; --c) {
                 int value = (int)*iterator;
@@ -44,15 +51,51 @@ RGBImage read_image(std::string name)
             image[i][j] = rgb;
         }
     }
-    stbi_image_free(rgb_image);
     return image;
 }
 
+/*
+ * Decodes an image, keeping the buffer of stb. Returns false if the file can't be read.
+ */
+bool DecodedImage::open(std::string name)
+{
+    ScopedTimer timer("decode_image");
+    close();
+    if (!exists(name)) {
+        std::cout << "Error: File " << name << " does not exist." << std::endl;
+        return false;
+    }
+
+    std::cout << "Info: reading file " << name << std::endl;
+
+    int width, height, bpp;
+    data_ = stbi_load(name.c_str(), &width, &height, &bpp, CHANNEL_NUM);
+    if (!data_) {
+        std::cout << "Error: File " << name << " can't be decoded (" << stbi_failure_reason() << ")." << std::endl;
+        return false;
+    }
+    width_ = width;
+    height_ = height;
+    return true;
+}
+
+void DecodedImage::close()
+{
+    if (data_) {
+        stbi_image_free(data_);
+    }
+    data_ = nullptr;
+    width_ = 0;
+    height_ = 0;
+}
+
 /*
  * Take a 2-dimensional vector with RGB values and write a png file.
+ * Returns false if the file can't be written.
  */
-void write_image(const RGBImage &image, std::string name)
+bool write_image(const RGBImage &image, std::string name)
 {
+    ScopedTimer timer("write_image");
     std::cout << "Info: writing file " << name << std::endl;
 
     int height = (int)image.size();
@@ -72,6 +115,357 @@ void write_image(const RGBImage &image, std::string name)
             }
         }
     }
-    stbi_write_png(name.c_str(), width, height, CHANNEL_NUM, rgb_image, width * CHANNEL_NUM);
+    const int written(stbi_write_png(name.c_str(), width, height, CHANNEL_NUM, rgb_image, width * CHANNEL_NUM));
     stbi_image_free(rgb_image);
+    if (!written) {
+        std::cout << "Error: could not write file " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Index map files
+ */
+
+#define INDEX_MAP_MAGIC "SEAMIDX"
+#define INDEX_MAP_VERSION 1
+#define INDEX_MAP_BYTE_ORDER 0x01020304     // Written in the byte order of the machine, checked when reading
+
+struct IndexMapHeader
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint16_t version;
+    uint8_t direction;
+    uint8_t energy;
+    uint8_t order_bits;
+    uint8_t encoding;
+    uint16_t reserved;
+    uint32_t width;
+    uint32_t height;
+    uint32_t min_width;
+    uint64_t payload_size;          // In bytes
+    uint8_t padding[24];            // The payload starts 64 bytes after the beginning of the file
+};
+
+static_assert(sizeof(IndexMapHeader) == 64, "index map header must be 64 bytes long");
+
+// Checks a header read from a file of file_size bytes (at least the size of the header) : the payload
+// must fit in the file and, when raw, have exactly one order per pixel, so that no order is read
+// outside the file.
+static bool check_header(const IndexMapHeader &header, size_t file_size, const std::string &name)
+{
+    if (std::strncmp(header.magic, INDEX_MAP_MAGIC, 8) != 0 || header.byte_order != INDEX_MAP_BYTE_ORDER) {
+        std::cout << "Error: " << name << " is not an index map file of this machine." << std::endl;
+        return false;
+    }
+    if (header.version != INDEX_MAP_VERSION) {
+        std::cout << "Error: unsupported index map version " << header.version << " in " << name << std::endl;
+        return false;
+    }
+    const uint64_t pixels(uint64_t(header.width) * header.height);           // Can't overflow (32 bits sizes)
+    const uint64_t bytes_per_order(header.order_bits / 8);
+    if ((header.order_bits != 16 && header.order_bits != 32) || header.encoding > INDEX_MAP_DELTA_RLE
+        || header.min_width > header.width || pixels > SIZE_MAX / sizeof(uint32_t)
+        || header.payload_size > file_size - sizeof(IndexMapHeader)
+        || (header.encoding == INDEX_MAP_RAW && header.payload_size != pixels * bytes_per_order)) {
+        std::cout << "Error: index map file " << name << " is corrupted." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Varint (7 bits per byte) used by the compressed payload.
+static void put_varint(std::vector<uint8_t> &bytes, uint64_t value)
+{
+    while (value >= 0x80) {
+        bytes.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(uint8_t(value));
+}
+
+static bool get_varint(const uint8_t *&iterator, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift(0); iterator != end && shift < 64; shift += 7) {
+        uint8_t byte(*iterator++);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Delta/RLE compression : each order is replaced by its difference with the pixel above (the pixel
+ * removed by the same seam is often just above). The stream is a list of varints t : if t is even,
+ * t/2 differences are 0, otherwise t/2 is the zigzag encoding of one non-zero difference.
+ */
+static std::vector<uint8_t> compress_orders(const FlatImage<uint32_t> &order)
+{
+    std::vector<uint8_t> bytes;
+    uint64_t zeros(0);
+    for (size_t i(0); i < order.height; ++i) {
+        for (size_t j(0); j < order.width; ++j) {
+            int64_t above(i == 0 ? 0 : int64_t(order(i-1, j)));
+            int64_t delta(int64_t(order(i, j)) - above);
+            if (delta == 0) {
+                ++zeros;
+                continue;
+            }
+            if (zeros > 0) {
+                put_varint(bytes, zeros << 1);
+                zeros = 0;
+            }
+            uint64_t zigzag(delta < 0 ? (uint64_t(-delta) << 1) - 1 : uint64_t(delta) << 1);
+            put_varint(bytes, (zigzag << 1) | 1);
+        }
+    }
+    if (zeros > 0) {
+        put_varint(bytes, zeros << 1);
+    }
+    return bytes;
+}
+
+static bool decompress_orders(const uint8_t *iterator, const uint8_t *end, FlatImage<uint32_t> &order)
+{
+    uint64_t zeros(0);
+    for (size_t i(0); i < order.height; ++i) {
+        for (size_t j(0); j < order.width; ++j) {
+            int64_t delta(0);
+            if (zeros > 0) {
+                --zeros;
+            } else {
+                uint64_t token;
+                if (!get_varint(iterator, end, token)) {
+                    return false;
+                }
+                if (token == 0) {
+                    return false;                       // Empty run : never written
+                }
+                if (!(token & 1)) {
+                    zeros = (token >> 1) - 1;           // This pixel is the first of the run
+                } else {
+                    uint64_t zigzag(token >> 1);
+                    delta = (zigzag & 1) ? -int64_t((zigzag + 1) >> 1) : int64_t(zigzag >> 1);
+                }
+            }
+            int64_t above(i == 0 ? 0 : int64_t(order(i-1, j)));
+            order(i, j) = uint32_t(above + delta);
+        }
+    }
+    return zeros == 0 && iterator == end;               // Nothing left after the last pixel
+}
+
+/*
+ * Writes the index map in a file. Returns false if the file can't be written.
+ */
+bool write_index_map(const SeamIndexMap &map, std::string name, IndexMapEncoding encoding)
+{
+    ScopedTimer timer("write_index_map");
+    std::cout << "Info: writing file " << name << std::endl;
+
+    IndexMapHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magic, INDEX_MAP_MAGIC, 8);
+    header.byte_order = INDEX_MAP_BYTE_ORDER;
+    header.version = INDEX_MAP_VERSION;
+    header.direction = map.direction;
+    header.energy = map.energy;
+    header.order_bits = (map.width - map.min_width < 0xFFFF) ? 16 : 32;    // 0xFFFF is kept for NOT_REMOVED
+    header.encoding = encoding;
+    header.width = map.width;
+    header.height = map.height;
+    header.min_width = map.min_width;
+
+    std::vector<uint8_t> payload;
+    if (encoding == INDEX_MAP_DELTA_RLE) {
+        payload = compress_orders(map.order);
+    } else if (header.order_bits == 16) {
+        payload.resize(map.width * map.height * 2);
+        uint16_t *iterator((uint16_t *)payload.data());
+        for (size_t i(0); i < map.height; ++i) {
+            for (size_t j(0); j < map.width; ++j) {
+                uint32_t order(map.order(i, j));
+                *iterator++ = (order == NOT_REMOVED) ? 0xFFFF : uint16_t(order);
+            }
+        }
+    } else {
+        payload.resize(map.width * map.height * 4);
+        uint32_t *iterator((uint32_t *)payload.data());
+        for (size_t i(0); i < map.height; ++i) {
+            iterator = std::copy(map.order.row(i), map.order.row(i) + map.width, iterator);
+        }
+    }
+    header.payload_size = payload.size();
+
+    std::ofstream file(name.c_str(), std::ios::binary);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)payload.data(), payload.size());
+    if (!file.good()) {
+        std::cout << "Error: could not write file " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+SeamIndexMap read_index_map(std::string name)
+{
+    ScopedTimer timer("read_index_map");
+    SeamIndexMap map;
+    map.width = map.height = map.min_width = 0;
+    map.direction = SEAM_VERTICAL;
+    map.energy = ENERGY_SOBEL;
+
+    if (!exists(name)) {
+        std::cout << "Error: File " << name << " does not exist." << std::endl;
+        return map;
+    }
+    std::cout << "Info: reading file " << name << std::endl;
+
+    std::ifstream file(name.c_str(), std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    IndexMapHeader header;
+    if (bytes.size() < sizeof(header)) {
+        std::cout << "Error: index map file " << name << " is corrupted." << std::endl;
+        return map;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (!check_header(header, bytes.size(), name)) {
+        return map;
+    }
+
+    FlatImage<uint32_t> order(header.width, header.height);
+    const uint8_t *payload(bytes.data() + sizeof(header));
+    if (header.encoding == INDEX_MAP_DELTA_RLE) {
+        if (!decompress_orders(payload, payload + header.payload_size, order)) {
+            std::cout << "Error: index map file " << name << " is corrupted." << std::endl;
+            return map;
+        }
+    } else if (header.order_bits == 16) {
+        const uint16_t *iterator((const uint16_t *)payload);
+        for (size_t k(0); k < order.pixels.size(); ++k) {
+            order.pixels[k] = (iterator[k] == 0xFFFF) ? NOT_REMOVED : iterator[k];
+        }
+    } else {
+        std::memcpy(order.pixels.data(), payload, order.pixels.size() * 4);
+    }
+
+    map.width = header.width;
+    map.height = header.height;
+    map.min_width = header.min_width;
+    map.direction = SeamDirection(header.direction);
+    map.energy = EnergyKind(header.energy);
+    map.order.width = header.width;
+    map.order.height = header.height;
+    map.order.stride = header.width;
+    map.order.pixels.swap(order.pixels);
+    return map;
+}
+
+MappedIndexMap::MappedIndexMap()
+    : data_(nullptr), size_(0), mapped_(false), payload_(nullptr), width_(0), height_(0), min_width_(0),
+      direction_(SEAM_VERTICAL), energy_(ENERGY_SOBEL), order_bits_(0)
+{
+}
+
+MappedIndexMap::~MappedIndexMap()
+{
+    close();
+}
+
+/*
+ * Maps a raw index map file in memory (reads it in a buffer where mmap is not available).
+ * Returns false if the file can't be used (compressed files have to be read with read_index_map).
+ */
+bool MappedIndexMap::open(std::string name)
+{
+    close();
+#ifndef _WIN32
+    int fd(::open(name.c_str(), O_RDONLY));
+    if (fd < 0) {
+        std::cout << "Error: File " << name << " does not exist." << std::endl;
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && size_t(status.st_size) >= sizeof(IndexMapHeader)) {
+        void *data(mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (data != MAP_FAILED) {
+            data_ = data;
+            size_ = status.st_size;
+            mapped_ = true;
+        }
+    }
+    ::close(fd);
+#endif
+    if (!data_) {
+        std::ifstream file(name.c_str(), std::ios::binary | std::ios::ate);
+        if (!file.good()) {
+            std::cout << "Error: File " << name << " does not exist." << std::endl;
+            return false;
+        }
+        size_ = file.tellg();
+        data_ = malloc(size_ > 0 ? size_ : 1);
+        file.seekg(0);
+        file.read((char *)data_, size_);
+    }
+
+    IndexMapHeader header;
+    if (size_ < sizeof(header)) {
+        std::cout << "Error: index map file " << name << " is corrupted." << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&header, data_, sizeof(header));
+    if (!check_header(header, size_, name)) {
+        close();
+        return false;
+    }
+    if (header.encoding != INDEX_MAP_RAW) {
+        std::cout << "Error: index map file " << name << " is compressed, it can't be mapped." << std::endl;
+        close();
+        return false;
+    }
+
+    payload_ = (const uint8_t *)data_ + sizeof(header);
+    width_ = header.width;
+    height_ = header.height;
+    min_width_ = header.min_width;
+    direction_ = SeamDirection(header.direction);
+    energy_ = EnergyKind(header.energy);
+    order_bits_ = header.order_bits;
+    return true;
+}
+
+void MappedIndexMap::close()
+{
+    if (data_) {
+#ifndef _WIN32
+        if (mapped_) {
+            munmap(data_, size_);
+        } else
+#endif
+        {
+            free(data_);
+        }
+    }
+    data_ = nullptr;
+    payload_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
+
+/*
+ * Removal order of a pixel (NOT_REMOVED if never removed).
+ */
+uint32_t MappedIndexMap::order(size_t row, size_t col) const
+{
+    if (order_bits_ == 16) {
+        uint16_t order(row16(row)[col]);
+        return order == 0xFFFF ? NOT_REMOVED : order;
+    }
+    return row32(row)[col];
 }
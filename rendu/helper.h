@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -18,4 +19,86 @@ RGBImage read_image(std::string name);
 /*
  * Take a 2-dimensional vector with RGB values and write a png file.
  */
-void write_image(const RGBImage &image, std::string name);
+bool write_image(const RGBImage &image, std::string name);
+
+/*
+ * Image decoded by stb : 3 bytes (red, green, blue) per pixel, row after row. The buffer is used as is,
+ * without repacking the pixels in ints (see to_gray and to_flat), and freed by close or the destructor.
+ */
+class DecodedImage
+{
+public:
+    DecodedImage() : data_(nullptr), width_(0), height_(0) {}
+    ~DecodedImage() { close(); }
+
+    bool open(std::string name);
+    void close();
+    bool empty() const { return data_ == nullptr; }
+
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+    const uint8_t *row(size_t r) const { return data_ + r * width_ * 3; }
+
+private:
+    DecodedImage(const DecodedImage &);                 // Not copyable
+    DecodedImage &operator=(const DecodedImage &);
+
+    uint8_t *data_;
+    size_t width_;
+    size_t height_;
+};
+
+/*
+ * Seam index map files (see build_index_map) :
+ * a 64 bytes header (size, direction, energy, encoding) followed by the removal order of each pixel,
+ * row after row, on 16 bits if the number of seams allows it, 32 bits otherwise.
+ * The payload is either raw (it can then be used directly from a memory mapping, see MappedIndexMap)
+ * or delta/RLE compressed (smaller, but it has to be decoded by read_index_map).
+ */
+enum IndexMapEncoding { INDEX_MAP_RAW = 0, INDEX_MAP_DELTA_RLE = 1 };
+
+bool write_index_map(const SeamIndexMap &map, std::string name, IndexMapEncoding encoding = INDEX_MAP_RAW);
+
+/*
+ * Reads an index map file (raw or compressed). Returns an empty map (order.empty()) on error.
+ */
+SeamIndexMap read_index_map(std::string name);
+
+/*
+ * Raw index map file mapped in memory : the orders are read in place, without any copy or decoding.
+ */
+class MappedIndexMap
+{
+public:
+    MappedIndexMap();
+    ~MappedIndexMap();
+
+    bool open(std::string name);
+    void close();
+    bool is_open() const { return payload_ != nullptr; }
+
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+    size_t min_width() const { return min_width_; }
+    SeamDirection direction() const { return direction_; }
+    EnergyKind energy() const { return energy_; }
+    int order_bits() const { return order_bits_; }
+    const uint16_t *row16(size_t row) const { return (const uint16_t *)payload_ + row * width_; }
+    const uint32_t *row32(size_t row) const { return (const uint32_t *)payload_ + row * width_; }
+    uint32_t order(size_t row, size_t col) const;
+
+private:
+    MappedIndexMap(const MappedIndexMap &);             // Not copyable
+    MappedIndexMap &operator=(const MappedIndexMap &);
+
+    void *data_;                    // Whole file
+    size_t size_;
+    bool mapped_;                   // false if the file was read in a buffer instead
+    const void *payload_;
+    size_t width_;
+    size_t height_;
+    size_t min_width_;
+    SeamDirection direction_;
+    EnergyKind energy_;
+    int order_bits_;
+};
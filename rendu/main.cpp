@@ -7,12 +7,16 @@
 //
 
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <tgmath.h>
 #include <vector>
 
+#include "extension.h"
 #include "helper.h"
+#include "profiler.h"
 #include "seam.h"
+#include "thread_pool.h"
 #include "unit_test.h"
 
 void test_to_gray(std::string const& in_path);
@@ -23,6 +27,12 @@ void test_remove_seam(std::string const& in_path, int num);
 
 int main(int argc, char **argv)
 {
+    // Set SEAM_THREADS=n to choose the number of threads (one per core by default)
+    const char *threads(getenv("SEAM_THREADS"));
+    if (threads) {
+        set_thread_count(atoi(threads));
+    }
+
     run_unit_tests();
 
     // Initialize with a default value
@@ -37,6 +47,10 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    // Set SEAM_PROFILE=file.json to get the time spent in each stage
+    const char *profile_path(getenv("SEAM_PROFILE"));
+    set_profiling(profile_path != nullptr);
+
     // // Uncomment for testing different phases:
     // test_to_gray(in_path);
     // test_smooth(in_path);
@@ -45,6 +59,9 @@ int main(int argc, char **argv)
     // test_hightlight_seam(in_path, num_seam);
     //  test_remove_seam(in_path, num_seam);
 
+    if (profile_path) {
+        write_profile(profile_path);
+    }
     return 0;
 }
 
@@ -93,14 +110,9 @@ void test_hightlight_seam(std::string const& in_path, int num)
 
 void test_remove_seam(std::string const& in_path, int num)
 {
-    RGBImage image(read_image(in_path));
+    FlatRGBImage image(to_flat(read_image(in_path)));
     if (!image.empty()) {
-        for (int i = 0; i < num; ++i) {
-            GrayImage gray_image(to_gray(image));
-            GrayImage sobeled_image(sobel(smooth(gray_image)));
-            Path seam = find_seam(sobeled_image);
-            image = remove_seam(image, seam);
-        }
-        write_image(image, "test_removed_seam.png");
+        image = carve_seams(image, num);    // Only the energy around each removed seam is recomputed
+        write_image(to_nested(image), "test_removed_seam.png");
     }
 };
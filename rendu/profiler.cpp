@@ -0,0 +1,87 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+atomic<bool> profiling_active(false);
+
+struct TimerStats
+{
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static mutex profile_mutex;                 // Timers and counters can be updated by several threads
+static map<string, TimerStats> timers;
+static map<string, uint64_t> counters;
+
+void set_profiling(bool enabled)
+{
+    profiling_active.store(enabled, memory_order_relaxed);
+}
+
+void reset_profile()
+{
+    lock_guard<mutex> lock(profile_mutex);
+    timers.clear();
+    counters.clear();
+}
+
+uint64_t profile_clock_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profile_record_time(const char *name, uint64_t duration_ns)
+{
+    lock_guard<mutex> lock(profile_mutex);
+    map<string, TimerStats>::iterator it(timers.find(name));
+    if (it == timers.end()) {
+        TimerStats stats = {0, 0, 0};
+        it = timers.insert(make_pair(string(name), stats)).first;
+    }
+    it->second.calls += 1;
+    it->second.total_ns += duration_ns;
+    it->second.max_ns = max(it->second.max_ns, duration_ns);
+}
+
+void profile_add_count(const char *name, uint64_t value)
+{
+    lock_guard<mutex> lock(profile_mutex);
+    counters[name] += value;
+}
+
+string profile_json()
+{
+    lock_guard<mutex> lock(profile_mutex);
+    ostringstream json;
+    json << "{\"timers\": {";
+    for (map<string, TimerStats>::const_iterator it(timers.begin()); it != timers.end(); ++it) {
+        json << (it == timers.begin() ? "" : ", ") << "\"" << it->first << "\": {\"calls\": " << it->second.calls
+             << ", \"total_ms\": " << it->second.total_ns / 1e6 << ", \"max_ms\": " << it->second.max_ns / 1e6 << "}";
+    }
+    json << "}, \"counters\": {";
+    for (map<string, uint64_t>::const_iterator it(counters.begin()); it != counters.end(); ++it) {
+        json << (it == counters.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+    }
+    json << "}}";
+    return json.str();
+}
+
+/*
+ * Writes profile_json() in the given file. Returns false if the file can't be written.
+ */
+bool write_profile(string name)
+{
+    cout << "Info: writing file " << name << endl;
+    ofstream file(name.c_str());
+    file << profile_json() << endl;
+    return file.good();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+/*
+ * Lightweight instrumentation : scoped timers and counters, disabled by default.
+ * When disabled, a timer or a counter only costs a relaxed load of profiling_active (an atomic, since
+ * set_profiling can be called while other threads time their stages).
+ *
+ *     ScopedTimer timer("to_gray");           // Time spent until the end of the block
+ *     profile_count("find_seam.pixels", n);   // Adds n to a counter
+ */
+
+extern std::atomic<bool> profiling_active;
+
+void set_profiling(bool enabled);
+void reset_profile();
+uint64_t profile_clock_ns();
+void profile_record_time(const char *name, uint64_t duration_ns);
+void profile_add_count(const char *name, uint64_t value);
+
+/*
+ * Timers and counters as a JSON object :
+ * {"timers": {"name": {"calls": 1, "total_ms": 2.5, "max_ms": 2.5}, ...}, "counters": {"name": 42, ...}}
+ */
+std::string profile_json();
+bool write_profile(std::string name);
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *name) : name_(profiling_active.load(std::memory_order_relaxed) ? name : nullptr), start_(0)
+    {
+        if (name_) {
+            start_ = profile_clock_ns();
+        }
+    }
+
+    ~ScopedTimer()
+    {
+        if (name_) {
+            profile_record_time(name_, profile_clock_ns() - start_);
+        }
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer &operator=(const ScopedTimer &);
+
+    const char *name_;              // nullptr if profiling was disabled at construction
+    uint64_t start_;
+};
+
+inline void profile_count(const char *name, uint64_t value = 1)
+{
+    if (profiling_active.load(std::memory_order_relaxed)) {
+        profile_add_count(name, value);
+    }
+}
@@ -0,0 +1,85 @@
+#include "pyramid.h"
+#include "profiler.h"
+#include "seam.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+FlatGrayImage downsample(const FlatGrayImage &energy)
+{
+    ScopedTimer timer("downsample");
+    FlatGrayImage coarse((energy.width + 1) / 2, (energy.height + 1) / 2);
+    parallel_rows(coarse.height, 4 * coarse.width, [&](size_t first, size_t last) {
+        for (size_t row(first) ; row < last ; ++row) {
+            const double *top(energy.row(2 * row));
+            const double *bottom(energy.row(min(2 * row + 1, energy.height - 1)));
+            const bool two_rows(2 * row + 1 < energy.height);
+            double *line(coarse.row(row));
+            for (size_t col(0) ; col < coarse.width ; ++col) {
+                const size_t left(2 * col), right(min(2 * col + 1, energy.width - 1));
+                double somme(top[left] + (right != left ? top[right] : 0.0));
+                if (two_rows) {
+                    somme += bottom[left] + (right != left ? bottom[right] : 0.0);
+                }
+                line[col] = somme;
+            }
+        }
+    });
+    return coarse;
+}
+
+// Seam of energy inside the corridor around the seam of the coarser level (half the size).
+// Two consecutive windows always overlap or touch, so a seam always exists inside the corridor.
+static Path refine_seam(const FlatGrayImage &energy, const Path &coarse_seam, size_t corridor)
+{
+    ColumnWindow window(energy.height, 0, 0);
+    for (size_t row(0) ; row < energy.height ; ++row) {
+        const size_t center(2 * coarse_seam[min(row / 2, coarse_seam.size() - 1)]);
+        window.first[row] = center > corridor ? center - corridor : 0;
+        window.last[row] = min(center + 1 + corridor, energy.width - 1);
+    }
+    return find_seam(energy, window);
+}
+
+Path find_seam_pyramid(const FlatGrayImage &energy, size_t corridor, size_t min_size)
+{
+    ScopedTimer timer("find_seam_pyramid");
+    vector<FlatGrayImage> levels;                                       // Half size, quarter size...
+    min_size = max(min_size, size_t(1));
+    for (const FlatGrayImage *finer(&energy) ; finer->width / 2 >= min_size && finer->height / 2 >= min_size ;
+         finer = &levels.back()) {
+        levels.push_back(downsample(*finer));
+    }
+    if (levels.empty()) {
+        return find_seam(energy);
+    }
+
+    Path seam(find_seam(levels.back()));
+    for (size_t level(levels.size() - 1) ; level-- > 0 ; ) {
+        seam = refine_seam(levels[level], seam, corridor);
+    }
+    return refine_seam(energy, seam, corridor);
+}
+
+double seam_energy(const FlatGrayImage &energy, const Path &seam)
+{
+    double somme(0.0);
+    for (size_t row(0) ; row < seam.size() ; ++row) {
+        somme += energy(row, seam[row]);
+    }
+    return somme;
+}
+
+double seam_energy_deviation(const FlatGrayImage &energy, const Path &seam)
+{
+    const double exact(seam_energy(energy, find_seam(energy)));
+    const double found(seam_energy(energy, seam));
+    if (exact == 0.0) {
+        return found == 0.0 ? 0.0 : numeric_limits<double>::infinity();
+    }
+    return (found - exact) / exact;
+}
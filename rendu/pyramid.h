@@ -0,0 +1,26 @@
+#pragma once
+
+#include "seam_types.h"
+
+/*
+ * Coarse to fine seam search for very large images.
+ *
+ *     energy (full size) -> half size -> quarter size -> ... (at least min_size pixels wide and high)
+ *
+ * The seam is first found exactly on the smallest energy map, then at each finer level only inside a
+ * corridor of corridor pixels on each side of the seam of the coarser level (scaled by 2), given to
+ * find_seam as a ColumnWindow. The work is
+ * then about (2 * corridor + 2) x height per level instead of width x height, but the seam is only
+ * optimal inside the corridors : seam_energy_deviation measures the difference with find_seam.
+ */
+
+// Energy map of half the size : each pixel is the sum of a block of 2 x 2 pixels (less on the borders).
+FlatGrayImage downsample(const FlatGrayImage &energy);
+
+Path find_seam_pyramid(const FlatGrayImage &energy, size_t corridor = 16, size_t min_size = 64);
+
+// Sum of the energies of the pixels of the seam.
+double seam_energy(const FlatGrayImage &energy, const Path &seam);
+
+// Relative excess energy of seam over the seam of find_seam (0 when seam is optimal).
+double seam_energy_deviation(const FlatGrayImage &energy, const Path &seam);
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cassert>
+#include <functional>
 #include <limits>
 #include <tgmath.h>
 #include <vector>
@@ -7,10 +8,79 @@
 
 #include "seam.h"
 #include "extension.h"
+#include "filter_simd.h"
+#include "fixed_kernel.h"
+#include "helper.h"
+#include "profiler.h"
+#include "thread_pool.h"
 
 using namespace std;
 
 
+// ***********************************
+// FLAT IMAGES
+// ***********************************
+
+// Copies a vector of vectors into a single row-major buffer.
+template <typename T>
+static FlatImage<T> flatten(const vector<vector<T>> &image)
+{
+    const size_t hauteur(image.size());
+    const size_t largeur(hauteur == 0 ? 0 : image[0].size());
+    FlatImage<T> flat(largeur, hauteur);
+    for (size_t i(0) ; i < hauteur ; ++i) {
+        copy(image[i].begin(), image[i].end(), flat.row(i));
+    }
+    return flat;
+}
+
+// Copies the visible part (width pixels of each row) of a flat image into a vector of vectors.
+template <typename T>
+static vector<vector<T>> unflatten(const FlatImage<T> &flat)
+{
+    vector<vector<T>> image(flat.height);
+    for (size_t i(0) ; i < flat.height ; ++i) {
+        image[i].assign(flat.row(i), flat.row(i) + flat.width);
+    }
+    return image;
+}
+
+FlatRGBImage to_flat(const RGBImage &image)
+{
+    return flatten(image);
+}
+
+FlatGrayImage to_flat(const GrayImage &gray)
+{
+    return flatten(gray);
+}
+
+RGBImage to_nested(const FlatRGBImage &image)
+{
+    return unflatten(image);
+}
+
+GrayImage to_nested(const FlatGrayImage &gray)
+{
+    return unflatten(gray);
+}
+
+// Packs the bytes of a decoded image in ints (0xRRGGBB), without going through a vector of vectors.
+FlatRGBImage to_flat(const DecodedImage &image)
+{
+    FlatRGBImage flat(image.width(), image.height());
+    parallel_rows(image.height(), image.width(), [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            const uint8_t *source(image.row(i));
+            int *line(flat.row(i));
+            for (size_t j(0) ; j < image.width() ; ++j, source += 3) {
+                line[j] = (source[0] << 16) + (source[1] << 8) + source[2];
+            }
+        }
+    });
+    return flat;
+}
+
 // ***********************************
 // TASK 1: COLOR
 // ***********************************
@@ -88,34 +158,71 @@ int get_RGB(double gray)
 // Converts  RGB image to grayscale double image.
 GrayImage to_gray(const RGBImage& cimage)
 {
-    const size_t line(cimage.size());
-    const size_t col(cimage[0].size());
-    GrayImage grimage(line, vector<double>(col));
-    
-    for (size_t i(0) ; i < line ; ++i ) {
-        for (size_t j(0) ; j < col ; ++j) {
-            double gr(get_gray(cimage[i][j]));
-            grimage[i][j] = gr;
+    return to_nested(to_gray(to_flat(cimage)));
+}
+
+// Converts grayscale double image to an RGB image.
+RGBImage to_RGB(const GrayImage& gimage)
+{
+    return to_nested(to_RGB(to_flat(gimage)));
+}
+
+FlatGrayImage to_gray(const FlatRGBImage& cimage)
+{
+    ScopedTimer timer("to_gray");
+    FlatGrayImage grimage(cimage.width, cimage.height);
+
+    parallel_rows(cimage.height, cimage.width, [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i ) {
+            const int *line(cimage.row(i));
+            double *grline(grimage.row(i));
+            for (size_t j(0) ; j < cimage.width ; ++j) {
+                grline[j] = get_gray(line[j]);
+            }
         }
-    }
+    });
 
     return grimage;
 }
 
-// Converts grayscale double image to an RGB image.
-RGBImage to_RGB(const GrayImage& gimage)
+// Gray levels read directly from the bytes of the decoded image, in a single pass.
+// Same operations as get_gray, so the same values as to_gray(to_flat(image)).
+FlatGrayImage to_gray(const DecodedImage &image)
 {
-    const size_t line(gimage.size());
-    const size_t col(gimage[0].size());
-    RGBImage rgimage(line, vector<int>(col));
-    
-    for (size_t i(0) ; i < line ; ++i ) {
-        for (size_t j(0) ; j < col ; ++j) {
-            int rgb(get_RGB(gimage[i][j]));
-            rgimage[i][j] = rgb;
+    ScopedTimer timer("to_gray");
+    FlatGrayImage grimage(image.width(), image.height());
+
+    parallel_rows(image.height(), image.width(), [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            const uint8_t *source(image.row(i));
+            double *grline(grimage.row(i));
+            for (size_t j(0) ; j < image.width() ; ++j, source += 3) {
+                const double red(source[0]/255.0);
+                const double green(source[1]/255.0);
+                const double blue(source[2]/255.0);
+                grline[j] = (blue+green+red)/3;
+            }
         }
-    }
-    
+    });
+
+    return grimage;
+}
+
+FlatRGBImage to_RGB(const FlatGrayImage& gimage)
+{
+    ScopedTimer timer("to_RGB");
+    FlatRGBImage rgimage(gimage.width, gimage.height);
+
+    parallel_rows(gimage.height, gimage.width, [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i ) {
+            const double *line(gimage.row(i));
+            int *rgline(rgimage.row(i));
+            for (size_t j(0) ; j < gimage.width ; ++j) {
+                rgline[j] = get_RGB(line[j]);
+            }
+        }
+    });
+
     return rgimage;
 }
 
@@ -134,109 +241,234 @@ void clamp(long& val, long max)
 // Convolve a single-channel image with the given kernel.
 GrayImage filter(const GrayImage &gray, const Kernel &kernel)
 {
-    GrayImage filteredgray(gray);
-    const size_t hauteur_gray(gray.size());
-    const size_t largeur_gray(gray[0].size());
-    const size_t taille_kernel(kernel.size());
-    
-    const size_t max_index1(hauteur_gray-1);
-    const size_t max_index2(largeur_gray-1);
-    const long int indice_kernel(-(taille_kernel / 2)-1);
-    long int indice_kernel1;
-    long int indice_kernel2;
-    
-    for (size_t i(0) ; i < hauteur_gray ; ++i){                         // Browse through all the lines of pixels of gray
-        for (size_t j(0) ; j < largeur_gray ; ++j){                     // Browse through all the columns of pixels of gray
-            long double somme(0.0);
-            indice_kernel1 = indice_kernel;
-            for (size_t k(0) ; k < taille_kernel ; ++k) {               // Browse through all the lines of the kernel
-                    indice_kernel2 = indice_kernel;
-                    ++indice_kernel1;
-                for (size_t c(0) ; c < taille_kernel ; ++c) {           // Browse through all the columns of the kernel
-                    ++indice_kernel2;
-                    long int index1(i + indice_kernel1);                // index1 and index2 are used to access all the adjacent elements of the pixel[i][j]
-                    long int index2(j + indice_kernel2);
-                    clamp(index1, max_index1);                          // Borderline cases
-                    clamp(index2, max_index2);
-                    somme += (kernel[k][c])*gray[index1][index2];
-                    }
-            }
-         filteredgray[i][j] = somme;                                    // Assigns the sum to the pixel[i][j]
-        }
-    }
-    return filteredgray;
+    return to_nested(filter(to_flat(gray), kernel));
 }
 
 // Smooth a single-channel image
 GrayImage smooth(const GrayImage &gray)
 {
-    GrayImage smoothgray(gray);
-    const Kernel smooth(
-                  { {0.1 , 0.1 , 0.1},
-                    {0.1 , 0.2 , 0.1},
-                    {0.1 , 0.1 , 0.1} }
-                  );
-
-    smoothgray = filter(smoothgray , smooth);
-
-    return {smoothgray};
+    return to_nested(smooth(to_flat(gray)));
 }
 
 // Compute horizontal Sobel filter
 
 GrayImage sobelX(const GrayImage &gray)
 {
-    GrayImage sobel_x(gray);
-    const Kernel sobel_1(
-                  { {-1, 0, 1},
-                    {-2, 0, 2},
-                    {-1, 0, 1} }
-                    );
-
-    sobel_x = filter(sobel_x, sobel_1);
-
-    return sobel_x;
+    return to_nested(sobelX(to_flat(gray)));
 }
 
 // Compute vertical Sobel filter
 
 GrayImage sobelY(const GrayImage &gray)
 {
-    GrayImage sobel_y(gray);
-    const Kernel sobel_2(
+    return to_nested(sobelY(to_flat(gray)));
+}
+
+// Compute the magnitude of combined Sobel filters
+
+GrayImage sobel(const GrayImage &gray)
+{
+    return to_nested(sobel(to_flat(gray)));
+}
+
+const Kernel SMOOTH_KERNEL(
+                  { {0.1 , 0.1 , 0.1},
+                    {0.1 , 0.2 , 0.1},
+                    {0.1 , 0.1 , 0.1} }
+                  );
+
+const Kernel SOBEL_X_KERNEL(
+                  { {-1, 0, 1},
+                    {-2, 0, 2},
+                    {-1, 0, 1} }
+                    );
+
+const Kernel SOBEL_Y_KERNEL(
                   { {-1, -2, -1},
                     {0, 0, 0},
                     {1, 2, 1} }
                     );
 
-    sobel_y = filter(sobel_y, sobel_2);
+// Convolution of the kernel around a single pixel (row, col) of a flat image.
+// The borders are handled by taking the nearest valid pixel.
+double filter_pixel(const FlatGrayImage &gray, const Kernel &kernel, size_t row, size_t col)
+{
+    const size_t taille_kernel(kernel.size());
+    const long max_index1(gray.height-1);
+    const long max_index2(gray.width-1);
+    const long demi_kernel(taille_kernel / 2);
 
-    return sobel_y;
+    double somme(0.0);                                          // Same operations as the vectorized version (filter_simd.cpp)
+    for (size_t k(0) ; k < taille_kernel ; ++k) {               // Browse through all the lines of the kernel
+        long index1(row + k - demi_kernel);                     // index1 and index2 are used to access all the adjacent elements of the pixel[row][col]
+        clamp(index1, max_index1);                              // Borderline cases
+        const double *source(gray.row(index1));
+        for (size_t c(0) ; c < taille_kernel ; ++c) {           // Browse through all the columns of the kernel
+            long index2(col + c - demi_kernel);
+            clamp(index2, max_index2);
+            somme += (kernel[k][c])*source[index2];
+        }
+    }
+    return somme;
 }
 
-// Compute the magnitude of combined Sobel filters
+// Convolve a flat single-channel image with the given kernel.
+// For 3x3 and 5x5 kernels the interior is computed with vector instructions when available,
+// and only the borders pixel by pixel. The rows are split in bands computed in parallel.
+FlatGrayImage filter(const FlatGrayImage &gray, const Kernel &kernel)
+{
+    ScopedTimer timer("filter");
+    FlatGrayImage filteredgray(gray.width, gray.height);
+    const size_t demi_kernel(kernel.size() / 2);
 
-GrayImage sobel(const GrayImage &gray)
+    parallel_rows(gray.height, gray.width, [&](size_t first, size_t last) {
+        const bool interior(filter_interior(gray, kernel, filteredgray, first, last));
+        for (size_t i(first) ; i < last ; ++i){                         // Browse through all the lines of pixels of the band
+            double *line(filteredgray.row(i));
+            const bool border_row(i < demi_kernel || i + demi_kernel >= gray.height);
+            for (size_t j(0) ; j < gray.width ; ++j){                   // Browse through all the columns of pixels of gray
+                if (interior && !border_row && j == demi_kernel) {
+                    j = gray.width - demi_kernel;                       // Jumps over the interior, already done
+                }
+                line[j] = filter_pixel(gray, kernel, i, j);
+            }
+        }
+    });
+    return filteredgray;
+}
+
+// The 3 kernels are applied as fixed kernels (see fixed_kernel.h) : same values as with
+// SMOOTH_KERNEL, SOBEL_X_KERNEL and SOBEL_Y_KERNEL, the zero taps of Sobel being skipped.
+FlatGrayImage smooth(const FlatGrayImage &gray)
 {
-    const GrayImage sobel_x(sobelX(gray));
-    const GrayImage sobel_y(sobelY(gray));
-    GrayImage sobel_final(gray);
+    ScopedTimer timer("smooth");
+    return filter<SmoothKernel>(gray);
+}
 
-    for (size_t i(0); i < gray.size(); ++i) {
-        for (size_t j(0); j < gray[0].size(); ++j) {
-            sobel_final[i][j] = sqrt((sobel_x[i][j]*sobel_x[i][j])+(sobel_y[i][j]*sobel_y[i][j]));
+FlatGrayImage sobelX(const FlatGrayImage &gray)
+{
+    return filter<SobelXKernel>(gray);
+}
+
+FlatGrayImage sobelY(const FlatGrayImage &gray)
+{
+    return filter<SobelYKernel>(gray);
+}
+
+FlatGrayImage sobel(const FlatGrayImage &gray)
+{
+    ScopedTimer timer("sobel");
+    const FlatGrayImage sobel_x(sobelX(gray));
+    const FlatGrayImage sobel_y(sobelY(gray));
+    FlatGrayImage sobel_final(gray.width, gray.height);
+
+    parallel_rows(gray.height, gray.width, [&](size_t first, size_t last) {
+        for (size_t i(first); i < last; ++i) {
+            const double *x(sobel_x.row(i));
+            const double *y(sobel_y.row(i));
+            double *line(sobel_final.row(i));
+            for (size_t j(0); j < gray.width; ++j) {
+                line[j] = sqrt((x[j]*x[j])+(y[j]*y[j]));
+            }
         }
-    }
-    
+    });
+
     return sobel_final;
 }
 
+// Smoothed row number row of gray, using separable sums : the smoothing kernel is 0.1 * (3x3 box) + 0.1 * (center).
+// column is a buffer of the image width, used for the vertical sums.
+static void smooth_row(const FlatGrayImage &gray, long row, double *smoothed, double *column)
+{
+    const long max_row(gray.height-1);
+    const long max_col(gray.width-1);
+    long up(row-1), down(row+1);
+    clamp(up, max_row);
+    clamp(down, max_row);
+    const double *above(gray.row(up));
+    const double *line(gray.row(row));
+    const double *below(gray.row(down));
+
+    for (long j(0) ; j <= max_col ; ++j) {                          // Vertical pass
+        column[j] = above[j] + line[j] + below[j];
+    }
+    for (long j(0) ; j <= max_col ; ++j) {                          // Horizontal pass
+        long left(j-1), right(j+1);
+        clamp(left, max_col);
+        clamp(right, max_col);
+        smoothed[j] = 0.1*(column[left] + column[j] + column[right]) + 0.1*line[j];
+    }
+}
+
+// Computes the rows [first, last) of sobel(smooth(gray)) in a single pass over the rows, without intermediate
+// images : only the 3 smoothed rows around the current one are kept, and both Sobel kernels are applied
+// as a vertical then an horizontal 1D pass ((1,2,1) x (-1,0,1) and (-1,0,1) x (1,2,1)).
+static void fused_energy_rows(const FlatGrayImage &gray, long first, long last, FlatGrayImage &energy)
+{
+    const long max_row(gray.height-1);
+    const long max_col(gray.width-1);
+
+    vector<double> buffer(5*gray.width);                            // 3 smoothed rows, then 2 rows for the vertical passes
+    double *smoothed[3] = {&buffer[0], &buffer[gray.width], &buffer[2*gray.width]};
+    double *vertical_x(&buffer[3*gray.width]);
+    double *vertical_y(&buffer[4*gray.width]);
+
+    for (long k(0) ; k < 3 ; ++k) {                                 // smoothed[0], [1], [2] are rows i-1, i and i+1 (clamped)
+        long row(first+k-1);
+        clamp(row, max_row);
+        smooth_row(gray, row, smoothed[k], vertical_x);
+    }
+
+    for (long i(first) ; i < last ; ++i) {
+        for (long j(0) ; j <= max_col ; ++j) {
+            vertical_x[j] = smoothed[0][j] + 2*smoothed[1][j] + smoothed[2][j];
+            vertical_y[j] = smoothed[2][j] - smoothed[0][j];
+        }
+        double *line(energy.row(i));
+        for (long j(0) ; j <= max_col ; ++j) {
+            long left(j-1), right(j+1);
+            clamp(left, max_col);
+            clamp(right, max_col);
+            const double x(vertical_x[right] - vertical_x[left]);
+            const double y(vertical_y[left] + 2*vertical_y[j] + vertical_y[right]);
+            line[j] = sqrt((x*x)+(y*y));
+        }
+
+        double *oldest(smoothed[0]);                                // Shifts the 3 rows window down
+        smoothed[0] = smoothed[1];
+        smoothed[1] = smoothed[2];
+        smoothed[2] = oldest;
+        if (i+2 <= max_row) {
+            smooth_row(gray, i+2, smoothed[2], vertical_x);
+        } else {
+            copy(smoothed[1], smoothed[1] + gray.width, smoothed[2]);   // Bottom border : row i+2 is clamped to the last one
+        }
+    }
+}
+
+// Computes sobel(smooth(gray)) without intermediate images, by bands of rows computed in parallel
+// (see fused_energy_rows). The sums are not done in the same order as filter, the results match
+// up to rounding errors.
+FlatGrayImage fused_energy(const FlatGrayImage &gray)
+{
+    ScopedTimer timer("fused_energy");
+    FlatGrayImage energy(gray.width, gray.height);
+    if (gray.empty()) {
+        return energy;
+    }
+    parallel_rows(gray.height, gray.width, [&](size_t first, size_t last) {
+        fused_energy_rows(gray, first, last, energy);
+    });
+    return energy;
+}
+
 // ************************************
 // TASK 3: SEAM
 // ************************************
 
 Graph create_graph(const GrayImage &gray)
 {
+    ScopedTimer timer("create_graph");
     const long double INF(numeric_limits<double>::max());    // Declarating useful constants
     const size_t hauteur(gray.size());
     const size_t largeur(gray[0].size());
@@ -282,6 +514,13 @@ Graph create_graph(const GrayImage &gray)
         graph[id].predecessor_to_target = 0;        // Properties common to all nodes, and applying manipulated vector (successors) to the struct
         graph[id].successors = successors;
     }
+    if (profiling_active.load(memory_order_relaxed)) {
+        size_t bytes(graph.size()*sizeof(Node));
+        for (size_t id(0); id < graph.size(); ++id) {
+            bytes += graph[id].successors.capacity()*sizeof(size_t);
+        }
+        profile_count("create_graph.bytes", bytes);
+    }
     return graph;
 }
 
@@ -289,6 +528,7 @@ Graph create_graph(const GrayImage &gray)
 // The path does NOT include the from and to Node
 Path shortest_path(Graph &graph, size_t from, size_t to)        // This fuction doesn't work (on Windows) without long doubles for costs and distance_to_target.
 {
+    ScopedTimer timer("shortest_path");
     Path pathfinder;
                     
     size_t startId(graph.size()-2);
@@ -298,8 +538,11 @@ Path shortest_path(Graph &graph, size_t from, size_t to)        // This fuction
     
     graph[from].distance_to_target = graph[from].costs;         // Beginning of Dijkstra's algorithm
     bool modified(true);
+    size_t passes(0);
+    size_t relaxations(0);
     while (modified) {
         modified = false;
+        ++passes;
         for (size_t i(0) ; i < graph.size() ; ++i) {
             for (size_t j(0) ; j < (graph[i].successors).size() ; ++j) {
                     size_t id((graph[i]).successors[j]);
@@ -307,10 +550,14 @@ Path shortest_path(Graph &graph, size_t from, size_t to)        // This fuction
                     (graph[id].distance_to_target) = (graph[i].distance_to_target + (graph[id]).costs);
                     (graph[id]).predecessor_to_target = i;                                                  // Assignment of new best predecessor
                     modified = true;
+                    ++relaxations;
                     }
                 }
             }
         }
+    profile_count("shortest_path.passes", passes);
+    profile_count("shortest_path.relaxations", relaxations);
+    profile_count("shortest_path.nodes_touched", passes*graph.size());
 
     size_t index(to);
     while (index != from){                                  // Retrieving shortest path from the modified graph, using the bests predecessors
@@ -326,10 +573,53 @@ Path shortest_path(Graph &graph, size_t from, size_t to)        // This fuction
 }
 
 
-Path find_seam(const GrayImage &gray)
+// Return shortest path from Node from to Node to, for a graph built by create_graph
+// The path does NOT include the from and to Node
+// Ids of create_graph follow the rows of the image, which is a topological order of the seam graph :
+// relaxing each node once (from first, then all ids in increasing order) gives the same result as shortest_path.
+Path shortest_path_dag(Graph &graph, size_t from, size_t to)
+{
+    ScopedTimer timer("shortest_path_dag");
+    Path pathfinder;
+
+    size_t startId(graph.size()-2);
+    if (to == startId){                                         // Same convention as shortest_path
+        return pathfinder;
+    }
+
+    graph[from].distance_to_target = graph[from].costs;
+    for (size_t k(0) ; k <= graph.size() ; ++k) {              // k == 0 stands for from, then every other id in row order
+        size_t i(k == 0 ? from : k-1);
+        if (k != 0 && i == from) {
+            continue;
+        }
+        for (size_t j(0) ; j < (graph[i].successors).size() ; ++j) {
+            size_t id((graph[i]).successors[j]);
+            if (graph[id].distance_to_target > graph[i].distance_to_target + (graph[id]).costs) {       // Strict comparison : on ties the leftmost predecessor is kept, like shortest_path
+                (graph[id].distance_to_target) = (graph[i].distance_to_target + (graph[id]).costs);
+                (graph[id]).predecessor_to_target = i;
+            }
+        }
+    }
+
+    size_t index(to);
+    while (index != from){                                  // Retrieving shortest path using the bests predecessors
+        index = ((graph[index]).predecessor_to_target);
+        if (index != from) {
+            pathfinder.push_back(index);
+        }
+    }
+
+    reverse(pathfinder.begin(), pathfinder.end());
+
+    return pathfinder;
+}
+
+// Reference version of find_seam, going through the whole graph (useful to debug the implicit version)
+Path find_seam_graph(const GrayImage &gray)
 {
-    Graph graph (create_graph(gray));                                           // Generate graph from gray image
-    Path pathseeker (shortest_path(graph , graph.size()-2 , graph.size()-1));   // Finds the shortest path, from up (startId) to bottom (endId)
+    Graph graph (create_graph(gray));                                               // Generate graph from gray image
+    Path pathseeker (shortest_path_dag(graph , graph.size()-2 , graph.size()-1));   // Single top to bottom pass, from up (startId) to bottom (endId)
     Path seam;
     for (size_t i(0) ; i < pathseeker.size() ; ++i ) {
         seam.push_back(get_col(pathseeker[i],gray[0].size()));                  // Computes column for a path of ids to form the final seam
@@ -337,6 +627,399 @@ Path find_seam(const GrayImage &gray)
     return seam;
 }
 
+Path find_seam(const GrayImage &gray)
+{
+    return find_seam(to_flat(gray));
+}
+
+// Cumulative energy of pixel col, reached from the best of its (up to 3) predecessors in the previous row.
+// The predecessors are compared from left to right with a strict comparison, like in shortest_path_dag,
+// offset receives the position of the best one (-1, 0 or +1).
+// Cost is double, or uint32_t for the integer energies of fixed_point.h.
+template <typename Cost>
+static Cost relax_pixel(const Cost *previous, size_t largeur, size_t col, Cost cost, signed char &offset)
+{
+    const size_t first(col == 0 ? col : col-1);            // Borderline cases
+    const size_t last(col == largeur-1 ? col : col+1);
+    Cost best(numeric_limits<Cost>::max());
+    offset = 0;
+    for (size_t k(first) ; k <= last ; ++k) {
+        Cost distance(previous[k] + cost);
+        if (distance < best) {
+            best = distance;
+            offset = (signed char)(k - col);
+        }
+    }
+    return best;
+}
+
+double best_predecessor(const double *previous, size_t largeur, size_t col, double cost, signed char &offset)
+{
+    return relax_pixel(previous, largeur, col, cost, offset);
+}
+
+uint32_t best_predecessor(const uint32_t *previous, size_t largeur, size_t col, uint32_t cost, signed char &offset)
+{
+    return relax_pixel(previous, largeur, col, cost, offset);
+}
+
+// Below this number of columns per thread, the rows of the cumulative energies are computed by a single thread :
+// the threads wait for each other at the end of each row, which costs more than a small row.
+static size_t seam_min_columns(4096);
+
+void set_seam_min_columns(size_t columns)
+{
+    seam_min_columns = max(columns, size_t(1));
+}
+
+// Columns [first, last) of a row, offsets[0] receiving the offset of column first.
+// Inside the row the 3 predecessors exist : they are compared without the bounds of relax_pixel,
+// in the same order and on the same sums, so the costs and offsets are the same.
+template <typename Cost, typename Energy>
+static void relax_row(const Cost *previous, const Energy *costs, Cost *current, size_t largeur,
+                      size_t first, size_t last, signed char *offsets)
+{
+    size_t col(first);
+    for ( ; col < last && col == 0 ; ++col) {
+        current[col] = relax_pixel<Cost>(previous, largeur, col, costs[col], offsets[col - first]);
+    }
+    const size_t interior(min(last, largeur - 1));
+    for ( ; col < interior ; ++col) {
+        const Cost cost(costs[col]);
+        const Cost left(previous[col-1] + cost), middle(previous[col] + cost), right(previous[col+1] + cost);
+        Cost best(left);
+        signed char offset(-1);
+        if (middle < best) {
+            best = middle;
+            offset = 0;
+        }
+        if (right < best) {
+            best = right;
+            offset = 1;
+        }
+        current[col] = best;
+        offsets[col - first] = offset;
+    }
+    for ( ; col < last ; ++col) {
+        current[col] = relax_pixel<Cost>(previous, largeur, col, costs[col], offsets[col - first]);
+    }
+}
+
+static void store_offsets(FlatOffsetImage &predecessors, size_t row, size_t first, const vector<signed char> &offsets)
+{
+    copy(offsets.begin(), offsets.end(), predecessors.row(row) + first);
+}
+
+// first is a multiple of 4 : whole bytes, the last one possibly incomplete.
+static void store_offsets(PackedOffsets &predecessors, size_t row, size_t first, const vector<signed char> &offsets)
+{
+    uint8_t *bytes(predecessors.row(row) + first / 4);
+    for (size_t k(0) ; k < offsets.size() ; k += 4) {
+        uint8_t byte(0);
+        for (size_t j(k) ; j < min(k + 4, offsets.size()) ; ++j) {
+            byte |= uint8_t(offsets[j] + 1) << (2 * (j - k));
+        }
+        bytes[k / 4] = byte;
+    }
+}
+
+// Computes the rows 1 to hauteur-1 of the cumulative energies and their best predecessors,
+// stored in a FlatOffsetImage or a PackedOffsets.
+// rows(row) is where the cumulative energies (of type Cost) of row are stored (row 0 filled by the caller),
+// relax(row, previous, current, first, last, offsets) computes the columns [first, last) of row.
+// For wide images each row is split in column chunks computed in parallel, with a barrier between
+// two rows ; every pixel is computed from the same values, so the results are the same as with a single thread.
+template <typename Cost, typename Predecessors, typename Rows, typename Relax>
+static void relax_rows(size_t hauteur, size_t largeur, Predecessors &predecessors, Rows rows, Relax relax)
+{
+    const size_t threads(min(thread_count(), largeur / seam_min_columns));
+
+    const function<void(size_t, size_t, Barrier &)> chunk([&](size_t index, size_t count, Barrier &barrier) {
+        // Chunks starting at multiples of 4 columns never share a byte of a PackedOffsets
+        const size_t first((largeur * index / count) & ~size_t(3));
+        const size_t last(index + 1 == count ? largeur : (largeur * (index+1) / count) & ~size_t(3));
+        vector<signed char> offsets(last - first);
+        for (size_t row(1) ; row < hauteur ; ++row) {
+            const Cost *previous(rows(row-1));
+            relax(row, previous, rows(row), first, last, offsets.data());
+            store_offsets(predecessors, row, first, offsets);
+            barrier.wait();                                             // The next row needs the whole row
+        }
+    });
+
+    if (threads < 2 || hauteur < 2) {
+        Barrier alone(1);
+        chunk(0, 1, alone);
+    } else {
+        thread_pool().run_together(threads, chunk);
+    }
+}
+
+// Backward energy : each pixel costs its energy, whatever the predecessor.
+template <typename Cost, typename Energy, typename Predecessors, typename Rows>
+static void relax_rows(const FlatImage<Energy> &energy, Predecessors &predecessors, Rows rows)
+{
+    const size_t largeur(energy.width);
+    relax_rows<Cost>(energy.height, largeur, predecessors, rows,
+                     [&](size_t row, const Cost *previous, Cost *current, size_t first, size_t last, signed char *offsets) {
+        relax_row(previous, energy.row(row), current, largeur, first, last, offsets);
+    });
+}
+
+// Seam ending at the leftmost of the best pixels of the last row (last_row holds the cumulative energies),
+// following the predecessors back to the first row.
+template <typename Cost, typename Predecessors>
+static Path backtrack(const Cost *last_row, const Predecessors &predecessors)
+{
+    const size_t hauteur(predecessors.height);
+    size_t col(0);
+    for (size_t k(1) ; k < predecessors.width ; ++k) {             // endId keeps the leftmost of the best last pixels
+        if (last_row[k] < last_row[col]) {
+            col = k;
+        }
+    }
+
+    Path seam(hauteur);
+    for (size_t row(hauteur) ; row-- > 0 ; ) {                      // Going back up using the predecessors
+        seam[row] = col;
+        col += predecessors(row, col);
+    }
+    return seam;
+}
+
+Path backtrack_seam(const double *last_row, const FlatOffsetImage &predecessors)
+{
+    return backtrack(last_row, predecessors);
+}
+
+Path backtrack_seam(const uint32_t *last_row, const FlatOffsetImage &predecessors)
+{
+    return backtrack(last_row, predecessors);
+}
+
+// Rows 1 to hauteur-1 computed by relax (see relax_rows) from the cumulative energies of row 0,
+// keeping two rows or the whole table (see find_seam_rows).
+template <typename Cost, typename Relax>
+static Path search_seam(size_t hauteur, size_t largeur, const Cost *first_row, SeamMemory memory, Relax relax)
+{
+    profile_count("find_seam.pixels", hauteur*largeur);
+    if (memory == SEAM_FULL_TABLE) {
+        FlatImage<Cost> distances(largeur, hauteur);
+        copy(first_row, first_row + largeur, distances.row(0));
+        FlatOffsetImage predecessors(largeur, hauteur);
+        relax_rows<Cost>(hauteur, largeur, predecessors, [&](size_t row) { return distances.row(row); }, relax);
+        profile_count("find_seam.bytes", predecessors.pixels.size() + distances.pixels.size()*sizeof(Cost));
+        return backtrack(distances.row(hauteur-1), predecessors);
+    }
+
+    vector<Cost> distances(2*largeur);                                  // Rows of even and odd numbers
+    copy(first_row, first_row + largeur, distances.begin());
+    PackedOffsets predecessors(largeur, hauteur);
+    relax_rows<Cost>(hauteur, largeur, predecessors, [&](size_t row) { return &distances[(row % 2) * largeur]; }, relax);
+    profile_count("find_seam.bytes", predecessors.bytes.size() + 2*largeur*sizeof(Cost));
+    return backtrack(&distances[((hauteur-1) % 2) * largeur], predecessors);
+}
+
+// Find the seam without building the graph : the successors of create_graph are implicit,
+// a pixel (row, col) being reached from (row-1, col-1), (row-1, col) or (row-1, col+1).
+// With SEAM_TWO_ROWS only the previous and current rows of distances are kept, plus 2 bits per pixel
+// storing which of the 3 predecessors is the best one (-1, 0 or +1), see PackedOffsets.
+// SEAM_FULL_TABLE keeps the distances of all the pixels and one byte per offset, as cumulative_energy.
+// The relaxation order is the one of shortest_path_dag, so the seams are the same in both modes.
+template <typename Cost, typename Energy>
+static Path find_seam_rows(const FlatImage<Energy> &energy, SeamMemory memory)
+{
+    ScopedTimer timer("find_seam");
+    const size_t largeur(energy.width);
+    vector<Cost> first_row(energy.row(0), energy.row(0) + largeur);    // Row 0 is reached directly from startId
+    return search_seam<Cost>(energy.height, largeur, first_row.data(), memory,
+                             [&](size_t row, const Cost *previous, Cost *current, size_t first, size_t last, signed char *offsets) {
+        relax_row(previous, energy.row(row), current, largeur, first, last, offsets);
+    });
+}
+
+Path find_seam(const FlatGrayImage &gray, SeamMemory memory)
+{
+    return find_seam_rows<double>(gray, memory);
+}
+
+// Same search on integer energies (see fixed_point.h) : the costs are added exactly, so the seam
+// does not depend on the compiler or the processor. The cumulative costs are stored on 32 bits,
+// enough for 65536 rows of any energies (and for any image with the energies of sobel_fixed).
+Path find_seam(const FlatEnergy16Image &energy, SeamMemory memory)
+{
+    return find_seam_rows<uint32_t>(energy, memory);
+}
+
+// Forward energy (Rubinstein, Shamir and Avidan, 2008) : removing the pixel (row, col) makes its left and
+// right neighbours adjacent (cost |right - left|), and if the seam comes from the upper left (right) pixel,
+// also makes the pixel above adjacent to the left (right) neighbour. costs receives the 3 costs,
+// for the predecessors col-1, col and col+1. The borders take the nearest pixel of the row.
+static void forward_costs(const double *up, const double *line, size_t largeur, size_t col, double costs[3])
+{
+    const double left(line[col == 0 ? col : col-1]);
+    const double right(line[col == largeur-1 ? col : col+1]);
+    const double middle(fabs(right - left));
+    costs[0] = middle + fabs(up[col] - left);
+    costs[1] = middle;
+    costs[2] = middle + fabs(up[col] - right);
+}
+
+// Same comparisons as relax_pixel, each predecessor having its own cost.
+static double forward_pixel(const double *previous, const double *up, const double *line, size_t largeur,
+                            size_t col, signed char &offset)
+{
+    double costs[3];
+    forward_costs(up, line, largeur, col, costs);
+    const size_t first(col == 0 ? col : col-1);
+    const size_t last(col == largeur-1 ? col : col+1);
+    double best(numeric_limits<double>::max());
+    offset = 0;
+    for (size_t k(first) ; k <= last ; ++k) {
+        double distance(previous[k] + costs[k + 1 - col]);
+        if (distance < best) {
+            best = distance;
+            offset = (signed char)(k - col);
+        }
+    }
+    return best;
+}
+
+// Seam of minimum forward energy, computed directly from the gray levels : the energies of the pixels
+// are never stored, so no smooth or sobel pass is needed. The inside of each row is computed by
+// forward_row (vector instructions, same results) and the borders by forward_pixel.
+Path find_seam_forward(const FlatGrayImage &gray, SeamMemory memory)
+{
+    ScopedTimer timer("find_seam_forward");
+    const size_t largeur(gray.width);
+    vector<double> first_row(largeur);
+    for (size_t col(0) ; col < largeur ; ++col) {                       // Row 0 : only the new horizontal neighbours
+        double costs[3];
+        forward_costs(gray.row(0), gray.row(0), largeur, col, costs);
+        first_row[col] = costs[1];
+    }
+    return search_seam<double>(gray.height, largeur, first_row.data(), memory,
+                               [&](size_t row, const double *previous, double *current, size_t first, size_t last, signed char *offsets) {
+        const double *up(gray.row(row-1));
+        const double *line(gray.row(row));
+        size_t col(first);
+        for ( ; col < last && col == 0 ; ++col) {
+            current[col] = forward_pixel(previous, up, line, largeur, col, offsets[col - first]);
+        }
+        const size_t interior(min(last, largeur - 1));
+        if (col < interior) {
+            col = forward_row(up, line, previous, current, offsets + (col - first), col, interior);
+        }
+        for ( ; col < last ; ++col) {
+            current[col] = forward_pixel(previous, up, line, largeur, col, offsets[col - first]);
+        }
+    });
+}
+
+// Seam of minimum energy among the ones going through the columns [window.first[row], window.last[row]]
+// of each row. The pixels are relaxed as in find_seam (same predecessors in the same order, strict
+// comparisons), so the seam is the one of find_seam when the window covers the whole rows.
+// Only the pixels of the window are computed, with one byte per pixel for the predecessors :
+// the time is proportional to the area of the window, not to the one of the image.
+// Returns an empty path (and reports it) if no seam fits in the window.
+template <typename Cost, typename Energy>
+static Path find_seam_window(const FlatImage<Energy> &energy, const ColumnWindow &window)
+{
+    ScopedTimer timer("find_seam");
+    const size_t hauteur(energy.height);
+    const size_t largeur(energy.width);
+    const vector<size_t> &first(window.first), &last(window.last);
+    assert(first.size() == hauteur && last.size() == hauteur);
+    vector<size_t> start(hauteur + 1, 0);                               // First pixel of each row in offsets
+    for (size_t row(0) ; row < hauteur ; ++row) {
+        assert(first[row] <= last[row] && last[row] < largeur);
+        start[row+1] = start[row] + last[row] - first[row] + 1;
+    }
+    profile_count("find_seam.pixels", start[hauteur]);
+    if (hauteur == 0) {
+        return Path();
+    }
+
+    // The pixels reached from the first row form an interval [lowest, highest] of each row :
+    // the ones inside it with their 3 predecessors in the interval of the previous row are computed
+    // by relax_row, the ones on its borders with their predecessors in the interval only.
+    vector<Cost> previous(largeur), current(largeur);                  // Indexed by column
+    vector<signed char> offsets(start[hauteur], 0);
+    copy(energy.row(0) + first[0], energy.row(0) + last[0] + 1, previous.begin() + first[0]);
+    size_t lowest(first[0]), highest(last[0]);
+    for (size_t row(1) ; row < hauteur ; ++row) {
+        const Energy *costs(energy.row(row));
+        signed char *row_offsets(offsets.data() + start[row]);         // Column col at col - first[row]
+        const size_t low(max(first[row], lowest == 0 ? lowest : lowest - 1));
+        const size_t high(min(last[row], highest + 1));
+        if (low > high) {
+            cout << "Error: no seam goes through the window." << endl;
+            return Path();
+        }
+        const size_t inside_first(max(low, lowest + 1)), inside_last(max(inside_first, min(high + 1, highest)));
+        for (size_t col(low) ; col <= high ; ++col) {
+            if (col == inside_first && inside_first < inside_last) {
+                relax_row(previous.data(), costs, current.data(), largeur, inside_first, inside_last,
+                          row_offsets + inside_first - first[row]);
+                col = inside_last - 1;
+                continue;
+            }
+            Cost best(numeric_limits<Cost>::max());
+            signed char &offset(row_offsets[col - first[row]]);
+            for (size_t k(max(col == 0 ? col : col-1, lowest)) ; k <= min(col+1, highest) ; ++k) {
+                const Cost distance(previous[k] + costs[col]);
+                if (distance < best) {
+                    best = distance;
+                    offset = (signed char)(k - col);
+                }
+            }
+            current[col] = best;
+        }
+        previous.swap(current);
+        lowest = low;
+        highest = high;
+    }
+
+    size_t col(lowest);
+    for (size_t k(col + 1) ; k <= highest ; ++k) {                     // Leftmost of the best last pixels
+        if (previous[k] < previous[col]) {
+            col = k;
+        }
+    }
+    Path seam(hauteur);
+    for (size_t row(hauteur) ; row-- > 0 ; ) {
+        seam[row] = col;
+        col += offsets[start[row] + col - first[row]];
+    }
+    return seam;
+}
+
+Path find_seam(const FlatGrayImage &energy, const ColumnWindow &window)
+{
+    return find_seam_window<double>(energy, window);
+}
+
+Path find_seam(const FlatEnergy16Image &energy, const ColumnWindow &window)
+{
+    return find_seam_window<uint32_t>(energy, window);
+}
+
+// Computes the whole table of cumulative energies (and best predecessors), with the same
+// relaxation as find_seam. Used when the table has to be kept between two seams.
+void cumulative_energy(const FlatGrayImage &energy, FlatGrayImage &cumulative, FlatOffsetImage &predecessors)
+{
+    ScopedTimer timer("cumulative_energy");
+    const size_t hauteur(energy.height);
+    const size_t largeur(energy.width);
+    cumulative = FlatGrayImage(largeur, hauteur);
+    predecessors = FlatOffsetImage(largeur, hauteur);
+
+    for (size_t col(0) ; col < largeur ; ++col) {
+        cumulative(0, col) = energy(0, col);
+    }
+    relax_rows<double>(energy, predecessors, [&](size_t row) { return cumulative.row(row); });
+}
+
 // ***********************************
 // TASK 3 provided functions
 // Highlight or remove seam from RGB or gray image
@@ -371,11 +1054,7 @@ RGBImage highlight_seam(const RGBImage &image, const Path &seam)
 
 GrayImage remove_seam(const GrayImage &gray, const Path &seam)
 {
-    GrayImage result(gray);
-    for (size_t row(0); row < seam.size(); ++row) {
-        result[row].erase(result[row].begin() + seam[row]);
-    }
-    return result;
+    return to_nested(remove_seam(to_flat(gray), seam));
 }
 
 
@@ -383,9 +1062,132 @@ GrayImage remove_seam(const GrayImage &gray, const Path &seam)
 // return the new RGB image (width is decreased by 1)
 RGBImage remove_seam(const RGBImage &image, const Path &seam)
 {
-    RGBImage result(image);
-    for (size_t row(0); row < seam.size(); ++row) {
-        result[row].erase(result[row].begin() + seam[row]);
+    return to_nested(remove_seam(to_flat(image), seam));
+}
+
+// Copies each row of a flat image without the pixel of the seam, in a single new buffer.
+template <typename T>
+static FlatImage<T> copy_without_seam(const FlatImage<T> &image, const Path &seam)
+{
+    ScopedTimer timer("remove_seam");
+    FlatImage<T> result(image.width-1, image.height);
+    for (size_t row(0); row < image.height; ++row) {
+        const T *source(image.row(row));
+        T *destination(result.row(row));
+        destination = copy(source, source + seam[row], destination);
+        copy(source + seam[row] + 1, source + image.width, destination);
     }
     return result;
 }
+
+// Shifts the end of each row of a flat image by one pixel to the left, over the seam.
+// The stride is kept, so no memory is allocated.
+template <typename T>
+static void erase_seam(FlatImage<T> &image, const Path &seam)
+{
+    ScopedTimer timer("remove_seam_in_place");
+    for (size_t row(0); row < image.height; ++row) {
+        T *line(image.row(row));
+        copy(line + seam[row] + 1, line + image.width, line + seam[row]);
+    }
+    --image.width;
+}
+
+FlatGrayImage remove_seam(const FlatGrayImage &gray, const Path &seam)
+{
+    return copy_without_seam(gray, seam);
+}
+
+FlatRGBImage remove_seam(const FlatRGBImage &image, const Path &seam)
+{
+    return copy_without_seam(image, seam);
+}
+
+// Remove specified seam directly in the given image (width is decreased by 1, stride is unchanged)
+void remove_seam_in_place(FlatGrayImage &gray, const Path &seam)
+{
+    erase_seam(gray, seam);
+}
+
+void remove_seam_in_place(FlatRGBImage &image, const Path &seam)
+{
+    erase_seam(image, seam);
+}
+
+void remove_seam_in_place(FlatOffsetImage &offsets, const Path &seam)
+{
+    erase_seam(offsets, seam);
+}
+
+void remove_seam_in_place(FlatGray8Image &gray, const Path &seam)
+{
+    erase_seam(gray, seam);
+}
+
+// Converts seams removed one after the other (each one given in the columns of the image
+// left by the previous ones) into columns of the original image.
+SeamList to_original_coordinates(const SeamList &seams)
+{
+    SeamList originals(seams);
+    if (seams.empty()) {
+        return originals;
+    }
+    const size_t hauteur(seams[0].size());
+    vector<size_t> removed;                                         // Original columns already removed in the row, sorted
+    for (size_t row(0); row < hauteur; ++row) {
+        removed.clear();
+        for (size_t k(0); k < seams.size(); ++k) {
+            size_t col(seams[k][row]);
+            vector<size_t>::iterator it(removed.begin());
+            while (it != removed.end() && *it <= col) {             // Each removed column on the left shifts the pixel by one
+                ++col;
+                ++it;
+            }
+            removed.insert(it, col);
+            originals[k][row] = col;
+        }
+    }
+    return originals;
+}
+
+// Removes all the seams (given in original columns, see to_original_coordinates) with a single
+// copy of each row into the new image.
+template <typename T>
+static FlatImage<T> copy_without_seams(const FlatImage<T> &image, const SeamList &seams)
+{
+    ScopedTimer timer("remove_seams");
+    FlatImage<T> result(image.width - seams.size(), image.height);
+    vector<size_t> removed(seams.size());
+    for (size_t row(0); row < image.height; ++row) {
+        for (size_t k(0); k < seams.size(); ++k) {
+            removed[k] = seams[k][row];
+        }
+        sort(removed.begin(), removed.end());
+        assert(adjacent_find(removed.begin(), removed.end()) == removed.end());    // Seams must not cross
+
+        const T *source(image.row(row));
+        T *destination(result.row(row));
+        size_t start(0);
+        for (size_t k(0); k < removed.size(); ++k) {                // Copies the pixels between two removed ones
+            destination = copy(source + start, source + removed[k], destination);
+            start = removed[k] + 1;
+        }
+        copy(source + start, source + image.width, destination);
+    }
+    return result;
+}
+
+RGBImage remove_seams(const RGBImage &image, const SeamList &seams)
+{
+    return to_nested(remove_seams(to_flat(image), seams));
+}
+
+FlatGrayImage remove_seams(const FlatGrayImage &gray, const SeamList &seams)
+{
+    return copy_without_seams(gray, seams);
+}
+
+FlatRGBImage remove_seams(const FlatRGBImage &image, const SeamList &seams)
+{
+    return copy_without_seams(image, seams);
+}
@@ -11,6 +11,15 @@
 
 #include "seam_types.h"
 
+class DecodedImage;
+
+// FLAT IMAGES: conversions from/to the vectors of vectors
+FlatRGBImage to_flat(const RGBImage &image);
+FlatGrayImage to_flat(const GrayImage &gray);
+FlatRGBImage to_flat(const DecodedImage &image);
+RGBImage to_nested(const FlatRGBImage &image);
+GrayImage to_nested(const FlatGrayImage &gray);
+
 // TASK 1: COLOR
 double get_red(int rgb);
 double get_green(int rgb);
@@ -20,24 +29,64 @@ int get_RGB(double red, double green, double blue);
 int get_RGB(double gray);
 GrayImage to_gray(const RGBImage &cimage);
 RGBImage to_RGB(const GrayImage &gimage);
+FlatGrayImage to_gray(const FlatRGBImage &cimage);
+FlatGrayImage to_gray(const DecodedImage &image);
+FlatRGBImage to_RGB(const FlatGrayImage &gimage);
 
 //  TASK 2: FILTER
 inline void clamp(int &val, int max);
+void clamp(long &val, long max);
+
+extern const Kernel SMOOTH_KERNEL;
+extern const Kernel SOBEL_X_KERNEL;
+extern const Kernel SOBEL_Y_KERNEL;
 
 GrayImage filter(const GrayImage &gray, const Kernel &kernel);
 GrayImage smooth(const GrayImage &gray);
 GrayImage sobelX(const GrayImage &gray);
 GrayImage sobelY(const GrayImage &gray);
 GrayImage sobel(const GrayImage &gray);
+double filter_pixel(const FlatGrayImage &gray, const Kernel &kernel, size_t row, size_t col);
+FlatGrayImage filter(const FlatGrayImage &gray, const Kernel &kernel);
+FlatGrayImage smooth(const FlatGrayImage &gray);
+FlatGrayImage sobelX(const FlatGrayImage &gray);
+FlatGrayImage sobelY(const FlatGrayImage &gray);
+FlatGrayImage sobel(const FlatGrayImage &gray);
+FlatGrayImage fused_energy(const FlatGrayImage &gray);
 
 //  TASK 3 NEW: SEAM
 
 Graph create_graph(const GrayImage &gray);
 Path shortest_path(Graph &graph, size_t from, size_t to);
+Path shortest_path_dag(Graph &graph, size_t from, size_t to);
 Path find_seam(const GrayImage &energy);
+Path find_seam_graph(const GrayImage &energy);
+Path find_seam(const FlatGrayImage &energy, SeamMemory memory = SEAM_TWO_ROWS);
+Path find_seam(const FlatEnergy16Image &energy, SeamMemory memory = SEAM_TWO_ROWS);
+Path find_seam_forward(const FlatGrayImage &gray, SeamMemory memory = SEAM_TWO_ROWS);
+Path find_seam(const FlatGrayImage &energy, const ColumnWindow &window);
+Path find_seam(const FlatEnergy16Image &energy, const ColumnWindow &window);
+double best_predecessor(const double *previous, size_t largeur, size_t col, double cost, signed char &offset);
+uint32_t best_predecessor(const uint32_t *previous, size_t largeur, size_t col, uint32_t cost, signed char &offset);
+void cumulative_energy(const FlatGrayImage &energy, FlatGrayImage &cumulative, FlatOffsetImage &predecessors);
+void set_seam_min_columns(size_t columns);
+Path backtrack_seam(const double *last_row, const FlatOffsetImage &predecessors);
+Path backtrack_seam(const uint32_t *last_row, const FlatOffsetImage &predecessors);
 
 // Provided functions
 GrayImage highlight_seam(const GrayImage &gray, const Path &seam);
 RGBImage highlight_seam(const RGBImage &image, const Path &seam);
 GrayImage remove_seam(const GrayImage &energy, const Path &seam);
 RGBImage remove_seam(const RGBImage &image, const Path &seam);
+FlatGrayImage remove_seam(const FlatGrayImage &gray, const Path &seam);
+FlatRGBImage remove_seam(const FlatRGBImage &image, const Path &seam);
+void remove_seam_in_place(FlatGrayImage &gray, const Path &seam);
+void remove_seam_in_place(FlatRGBImage &image, const Path &seam);
+void remove_seam_in_place(FlatOffsetImage &offsets, const Path &seam);
+void remove_seam_in_place(FlatGray8Image &gray, const Path &seam);
+
+// Several seams at once, given as columns of the original image
+SeamList to_original_coordinates(const SeamList &seams);
+RGBImage remove_seams(const RGBImage &image, const SeamList &seams);
+FlatGrayImage remove_seams(const FlatGrayImage &gray, const SeamList &seams);
+FlatRGBImage remove_seams(const FlatRGBImage &image, const SeamList &seams);
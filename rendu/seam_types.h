@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -7,6 +8,7 @@ typedef std::vector<std::vector<int>> RGBImage;
 typedef std::vector<std::vector<double>> GrayImage;
 typedef std::vector<std::vector<double>> Kernel;
 typedef std::vector<size_t> Path;
+typedef std::vector<Path> SeamList;
 
 struct Node
 {
@@ -17,3 +19,78 @@ struct Node
 };
 
 typedef std::vector<Node> Graph;
+
+// Row-major image stored in a single buffer.
+// stride is the number of pixels between the beginning of two consecutive rows : it is equal to
+// width for a new image, and stays the same when seams are removed in place (width decreases).
+template <typename T>
+struct FlatImage
+{
+    size_t width;
+    size_t height;
+    size_t stride;
+    std::vector<T> pixels;
+
+    FlatImage() : width(0), height(0), stride(0) {}
+    FlatImage(size_t w, size_t h, T value = T()) : width(w), height(h), stride(w), pixels(w*h, value) {}
+
+    bool empty() const { return width == 0 || height == 0; }
+    T *row(size_t r) { return pixels.data() + r*stride; }
+    const T *row(size_t r) const { return pixels.data() + r*stride; }
+    T &operator()(size_t r, size_t c) { return pixels[r*stride + c]; }
+    const T &operator()(size_t r, size_t c) const { return pixels[r*stride + c]; }
+};
+
+typedef FlatImage<int> FlatRGBImage;
+typedef FlatImage<double> FlatGrayImage;
+typedef FlatImage<signed char> FlatOffsetImage;      // Column offset (-1, 0 or +1) of the best predecessor of each pixel
+typedef FlatImage<uint8_t> FlatGray8Image;           // Gray levels 0-255 (see fixed_point.h)
+typedef FlatImage<uint16_t> FlatEnergy16Image;       // Integer smoothed images and energies
+
+// Column offsets (-1, 0 or +1) of the best predecessors packed on 2 bits per pixel, 4 pixels per byte
+// (a 100 MP image needs 25 MB). Used by find_seam, which only reads them back once.
+struct PackedOffsets
+{
+    size_t width;
+    size_t height;
+    size_t stride;                  // Bytes per row
+    std::vector<uint8_t> bytes;
+
+    PackedOffsets() : width(0), height(0), stride(0) {}
+    PackedOffsets(size_t w, size_t h) : width(w), height(h), stride((w + 3) / 4), bytes(stride*h) {}
+
+    uint8_t *row(size_t r) { return bytes.data() + r*stride; }
+    int operator()(size_t r, size_t c) const { return int((bytes[r*stride + c/4] >> (2 * (c%4))) & 3) - 1; }
+};
+
+enum SeamDirection { SEAM_VERTICAL = 0, SEAM_HORIZONTAL = 1 };
+
+// Columns first[row] to last[row] (included) of each row, where find_seam may look for the seam :
+// a band for a region of interest, a corridor around a previous seam...
+struct ColumnWindow
+{
+    std::vector<size_t> first;
+    std::vector<size_t> last;
+
+    ColumnWindow() {}
+    ColumnWindow(size_t height, size_t first_col, size_t last_col) : first(height, first_col), last(height, last_col) {}
+};
+
+// Cumulative energies kept by find_seam : the previous and current rows only (a few KB, which stay
+// in the L1 cache), or the whole table (one Cost per pixel, as cumulative_energy).
+enum SeamMemory { SEAM_TWO_ROWS = 0, SEAM_FULL_TABLE = 1 };
+enum EnergyKind { ENERGY_SOBEL = 0,            // sobel(smooth(gray))
+                  ENERGY_FORWARD = 1 };         // Cost of the pixels made adjacent by the removal, see find_seam_forward
+
+const uint32_t NOT_REMOVED = 0xFFFFFFFF;
+
+// Order in which the pixels of an image are removed by successive seams
+struct SeamIndexMap
+{
+    size_t width;                   // Size of the original image
+    size_t height;
+    size_t min_width;               // Width of the image once all the seams are removed
+    SeamDirection direction;
+    EnergyKind energy;
+    FlatImage<uint32_t> order;      // Iteration at which each pixel is removed (NOT_REMOVED if never)
+};
@@ -0,0 +1,298 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+static thread_local bool inside_task(false);       // True while a thread of a pool runs a task
+
+ThreadPool::ThreadPool(size_t threads)
+    : task_(nullptr), count_(0), next_(0), finished_(0), generation_(0), stop_(false)
+{
+    for (size_t i(1) ; i < threads ; ++i) {
+        workers_.push_back(thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (size_t i(0) ; i < workers_.size() ; ++i) {
+        workers_[i].join();
+    }
+}
+
+void Barrier::wait()
+{
+    if (count_ == 1) {
+        return;
+    }
+    const unsigned long generation(generation_);
+    if (++waiting_ == count_) {                                 // Last one : releases the others
+        waiting_ = 0;
+        {
+            lock_guard<mutex> lock(mutex_);
+            ++generation_;
+        }
+        released_.notify_all();
+        return;
+    }
+    for (size_t spin(0) ; spin < 1000 ; ++spin) {
+        if (generation_ != generation) {
+            return;
+        }
+        this_thread::yield();
+    }
+    unique_lock<mutex> lock(mutex_);
+    released_.wait(lock, [&]() { return generation_ != generation; });
+}
+
+// Hands count tasks to the workers, or returns false if the pool can't be used (busy, or called from a task).
+bool ThreadPool::start(size_t count, const function<void(size_t)> &task)
+{
+    if (workers_.empty() || count < 2 || inside_task || !busy_.try_lock()) {
+        return false;
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        task_ = &task;
+        count_ = count;
+        next_ = 0;
+        finished_ = 0;
+        ++generation_;
+    }
+    start_.notify_all();
+    return true;
+}
+
+// Takes part in the tasks handed by start, and waits until all of them are done.
+void ThreadPool::finish()
+{
+    run_tasks();
+    {
+        unique_lock<mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return finished_ == count_; });
+        task_ = nullptr;
+    }
+    busy_.unlock();
+}
+
+void ThreadPool::run(size_t count, const function<void(size_t)> &task)
+{
+    if (!start(count, task)) {
+        for (size_t i(0) ; i < count ; ++i) {
+            task(i);
+        }
+        return;
+    }
+    finish();
+}
+
+// A thread holding a task stays in it until all the tasks have reached the barrier, so with
+// at most size() tasks, each of them gets its own thread.
+void ThreadPool::run_together(size_t count, const function<void(size_t, size_t, Barrier &)> &task)
+{
+    count = min(count, size());
+    Barrier barrier(count);
+    const function<void(size_t)> each([&](size_t index) { task(index, count, barrier); });
+    if (!start(count, each)) {
+        Barrier alone(1);
+        task(0, 1, alone);
+        return;
+    }
+    finish();
+}
+
+// Takes the tasks one by one until there is none left.
+void ThreadPool::run_tasks()
+{
+    while (true) {
+        const function<void(size_t)> *task;
+        size_t index;
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (next_ >= count_) {
+                return;
+            }
+            task = task_;
+            index = next_++;
+        }
+        inside_task = true;
+        (*task)(index);
+        inside_task = false;
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (++finished_ == count_) {
+                done_.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::work()
+{
+    unsigned long seen(0);
+    while (true) {
+        {
+            unique_lock<mutex> lock(mutex_);
+            start_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+        }
+        run_tasks();
+    }
+}
+
+static size_t requested_threads(0);
+static unique_ptr<ThreadPool> shared_pool;
+static mutex shared_pool_mutex;
+
+size_t thread_count()
+{
+    return requested_threads ? requested_threads : max(thread::hardware_concurrency(), 1u);
+}
+
+// Must not be called while the shared pool is running tasks.
+void set_thread_count(size_t threads)
+{
+    lock_guard<mutex> lock(shared_pool_mutex);
+    requested_threads = threads;
+    if (shared_pool && shared_pool->size() != thread_count()) {
+        shared_pool.reset();
+    }
+}
+
+// Pool shared by all the stages, created at the first use.
+ThreadPool &thread_pool()
+{
+    lock_guard<mutex> lock(shared_pool_mutex);
+    if (!shared_pool) {
+        shared_pool.reset(new ThreadPool(thread_count()));
+    }
+    return *shared_pool;
+}
+
+void parallel_rows(size_t rows, size_t width, const function<void(size_t, size_t)> &band, size_t min_pixels)
+{
+    if (rows < 2 || rows * width < min_pixels || thread_count() == 1) {
+        band(0, rows);
+        return;
+    }
+    // A few bands per thread, so that a slow thread does not keep the others waiting
+    const size_t bands(min(rows, 4 * thread_pool().size()));
+    thread_pool().run(bands, [&](size_t k) {
+        band(rows * k / bands, rows * (k+1) / bands);
+    });
+}
+
+// Pool and number of the worker running on this thread, if any.
+static thread_local WorkStealingPool *current_pool(nullptr);
+static thread_local size_t current_worker(0);
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : queued_(0), pending_(0), sleeping_(0), next_queue_(0), stop_(false)
+{
+    threads = max(threads, size_t(1));
+    for (size_t i(0) ; i < threads ; ++i) {
+        queues_.push_back(unique_ptr<Queue>(new Queue));
+    }
+    for (size_t i(0) ; i < threads ; ++i) {
+        workers_.push_back(thread(&WorkStealingPool::work, this, i));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    wait();
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i(0) ; i < workers_.size() ; ++i) {
+        workers_[i].join();
+    }
+}
+
+// pending_ is counted before the task can run, queued_ only once it is in a queue, so that a worker
+// which claims a task (decrements queued_) always finds one.
+void WorkStealingPool::submit(const function<void()> &task)
+{
+    pending_.fetch_add(1);
+    {
+        Queue &queue(*queues_[current_pool == this ? current_worker : next_queue_.fetch_add(1) % queues_.size()]);
+        lock_guard<mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    queued_.fetch_add(1);
+    if (sleeping_.load() > 0) {                         // Read after queued_ is incremented : either the worker
+        lock_guard<mutex> lock(mutex_);                 // going to sleep sees the task, or it is woken up
+        wake_.notify_one();
+    }
+}
+
+void WorkStealingPool::wait()
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return pending_.load() == 0; });
+}
+
+// Newest task of the worker's own queue, or else the oldest task of another queue.
+bool WorkStealingPool::take(size_t worker, function<void()> &task)
+{
+    for (size_t k(0) ; k < queues_.size() ; ++k) {
+        Queue &queue(*queues_[(worker + k) % queues_.size()]);
+        lock_guard<mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            if (k == 0) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            } else {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::work(size_t worker)
+{
+    current_pool = this;
+    current_worker = worker;
+    function<void()> task;
+    while (true) {
+        size_t queued(queued_.load());
+        if (queued == 0) {
+            unique_lock<mutex> lock(mutex_);
+            sleeping_.fetch_add(1);
+            wake_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+            sleeping_.fetch_sub(1);
+            if (stop_ && queued_.load() == 0) {
+                return;
+            }
+            continue;
+        }
+        if (!queued_.compare_exchange_weak(queued, queued - 1)) {
+            continue;                               // Claimed by another worker in the meantime
+        }
+        // The claimed task is in a queue, but another claimant may take it between two queues of the scan.
+        while (!take(worker, task)) {
+            this_thread::yield();
+        }
+        task();
+        task = nullptr;
+        if (pending_.fetch_sub(1) == 1) {
+            lock_guard<mutex> lock(mutex_);
+            idle_.notify_all();
+        }
+    }
+}
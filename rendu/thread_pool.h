@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Small pool of worker threads, used to split the rows of an image between the cores.
+ *
+ *     parallel_rows(height, [&](size_t first, size_t last) {
+ *         for (size_t i(first) ; i < last ; ++i) { ... }       // Rows [first, last)
+ *     });
+ *
+ * Each row is computed by exactly the same code whatever the number of threads,
+ * so the results do not depend on it.
+ */
+
+// Blocks the threads calling wait until count of them are waiting, then releases them all.
+// The waiting threads first spin for a short time, the next row being usually ready quickly.
+class Barrier
+{
+public:
+    explicit Barrier(size_t count) : count_(count), waiting_(0), generation_(0) {}
+
+    void wait();
+
+private:
+    Barrier(const Barrier &);
+    Barrier &operator=(const Barrier &);
+
+    const size_t count_;
+    std::atomic<size_t> waiting_;
+    std::atomic<unsigned long> generation_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    size_t size() const { return workers_.size() + 1; }    // The calling thread works too
+
+    // Calls task(0), ..., task(count-1) on the threads of the pool and returns when all are done.
+    // When the pool is already busy (call from a task, or from another thread), the tasks are run by the caller.
+    void run(size_t count, const std::function<void(size_t)> &task);
+
+    // Calls task(index, n, barrier) for index in [0, n) at the same time on n different threads,
+    // so that the tasks can wait for each other with barrier. n is count (at most size()),
+    // or 1 when the pool is already busy.
+    void run_together(size_t count, const std::function<void(size_t, size_t, Barrier &)> &task);
+
+private:
+    bool start(size_t count, const std::function<void(size_t)> &task);
+    void finish();
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+    void work();
+    void run_tasks();
+
+    std::vector<std::thread> workers_;
+    std::mutex busy_;                           // Held by the thread which submitted the current tasks
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    const std::function<void(size_t)> *task_;
+    size_t count_, next_, finished_;
+    unsigned long generation_;                  // Incremented for each call of run
+    bool stop_;
+};
+
+size_t thread_count();
+void set_thread_count(size_t threads);          // 0 : one thread per core
+ThreadPool &thread_pool();
+
+// Splits the rows [0, rows) in bands computed in parallel by band(first, last).
+// Small images (less than min_pixels) are computed by the calling thread only.
+void parallel_rows(size_t rows, size_t width, const std::function<void(size_t, size_t)> &band,
+                   size_t min_pixels = 1 << 16);
+
+/*
+ * Pool running independent tasks (several images at once, see batch.h), each worker having its own queue.
+ * A task submitted from a worker goes to the back of its queue and is the next one it runs (the next stage
+ * of the same image, whose data is still in its cache) ; an idle worker steals from the front of the
+ * queues of the others (the oldest tasks). Each queue has its own lock and the task counts are atomic :
+ * the mutex of the pool is only taken to put an idle worker to sleep and to wake it up.
+ */
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t threads);
+    ~WorkStealingPool();                        // Waits for the submitted tasks
+
+    size_t size() const { return workers_.size(); }
+    void submit(const std::function<void()> &task);
+    void wait();                                // Until all the submitted tasks (and the ones they submit) are done
+
+private:
+    WorkStealingPool(const WorkStealingPool &);
+    WorkStealingPool &operator=(const WorkStealingPool &);
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take(size_t worker, std::function<void()> &task);
+    void work(size_t worker);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;                          // Only for wake_, idle_ and stop_
+    std::condition_variable wake_, idle_;
+    std::atomic<size_t> queued_;                // Tasks in the queues not claimed by a worker yet
+    std::atomic<size_t> pending_;               // Tasks submitted and not finished
+    std::atomic<size_t> sleeping_;              // Workers waiting on wake_
+    std::atomic<size_t> next_queue_;            // Queue of the next task submitted from outside the pool
+    bool stop_;
+};
+
+/*
+ * Queue between two stages of a pipeline (see run_pipeline) : push waits while the queue is full,
+ * so a fast stage can't get more than capacity items ahead of the next one.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max(capacity, size_t(1))), closed_(false) {}
+
+    void push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]() { return items_.size() < capacity_; });
+        items_.push_back(item);
+        not_empty_.notify_one();
+    }
+
+    // Waits for an item. Returns false once the queue is closed and empty.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]() { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return false;
+        }
+        item = items_.front();
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_full_, not_empty_;
+};
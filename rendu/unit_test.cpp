@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cmath> // std::fabs
 #include <iostream> // std::cerr, std::endl
@@ -5,9 +6,19 @@
 #include <tuple>
 #include <iomanip>
 #include <bitset>
+#include <cstdio> // std::remove
+#include <cstdlib> // rand, srand
 
+#include "batch.h"
+#include "extension.h"
+#include "filter_simd.h"
+#include "fixed_kernel.h"
+#include "fixed_point.h"
 #include "helper.h"
+#include "profiler.h"
+#include "pyramid.h"
 #include "seam.h"
+#include "thread_pool.h"
 #include "unit_test.h"
 
 using namespace std;
@@ -196,6 +207,28 @@ void check_equal(GrayImage const& expected, GrayImage const& computed)
     std::cerr << "   computed: "; print_image(computed);
 }
 
+void check_equal(std::string const& expected, std::string const& computed)
+{
+    if (expected == computed) {
+        std::cerr << "[Passed]" << std::endl;
+        return;
+    }
+    std::cerr << "[Failed]" << std::endl;
+    std::cerr << "   expected: " << expected << std::endl;
+    std::cerr << "   computed: " << computed << std::endl;
+}
+
+void check_equal(RGBImage const& expected, RGBImage const& computed)
+{
+    if (expected == computed) {
+        std::cerr << "[Passed]" << std::endl;
+        return;
+    }
+    std::cerr << "[Failed]" << std::endl;
+    std::cerr << "   expected: " << expected.size() << " rows of " << (expected.empty() ? 0 : expected[0].size()) << " pixels" << std::endl;
+    std::cerr << "   computed: " << computed.size() << " rows of " << (computed.empty() ? 0 : computed[0].size()) << " pixels" << std::endl;
+}
+
 void test_color()
 {
     std::vector<ColorInfo> colors = {{
@@ -531,6 +564,817 @@ void test_find_seam_1()
     check_equal({0, 1, 2, 1}, x_coordinates);
 }
 
+void test_shortest_path_dag_1()
+{
+    constexpr auto MAX_DIST = std::numeric_limits<double>::max();
+    Graph graph;
+    graph.push_back({{4, 5}, 0, MAX_DIST, 0});
+    graph.push_back({{4, 5, 6}, 0.1, MAX_DIST, 0});
+    graph.push_back({{5, 6, 7}, 0.2, MAX_DIST, 0});
+    graph.push_back({{6, 7}, 0.3, MAX_DIST, 0});
+    graph.push_back({{8, 9}, 0.4, MAX_DIST, 0});
+    graph.push_back({{8, 9, 10}, 0.5, MAX_DIST, 0});
+    graph.push_back({{9, 10, 11}, 0.6, MAX_DIST, 0});
+    graph.push_back({{10, 11}, 0.7, MAX_DIST, 0});
+    graph.push_back({{13}, 0.8, MAX_DIST, 0});
+    graph.push_back({{13}, 0.9, MAX_DIST, 0});
+    graph.push_back({{13}, 1.0, MAX_DIST, 0});
+    graph.push_back({{13}, 1.1, MAX_DIST, 0});
+    graph.push_back({{0, 1, 2, 3}, 0, MAX_DIST, 0});
+    graph.push_back({{}, 0, MAX_DIST, 0});
+
+    print_header("test_shortest_path_dag_1");
+    Graph copy(graph);
+    Path computed = shortest_path_dag(copy, 12, 13);
+    check_equal({0, 4, 8}, computed);
+    copy = graph;
+    computed = shortest_path_dag(copy, 12, 12);
+    check_equal({}, computed);
+}
+
+// Random image whose values are multiples of 1/levels (small levels give many ties)
+GrayImage random_gray_image(size_t rows, size_t cols, unsigned seed, int levels)
+{
+    srand(seed);
+    GrayImage gray(rows, std::vector<double>(cols));
+    for (size_t i = 0u; i < rows; ++i) {
+        for (size_t j = 0u; j < cols; ++j) {
+            gray[i][j] = (rand() % (levels + 1)) / double(levels);
+        }
+    }
+    return gray;
+}
+
+// Seam of the original relaxation algorithm, used as reference
+Path reference_seam(GrayImage const& gray)
+{
+    Graph graph(create_graph(gray));
+    Path ids(shortest_path(graph, graph.size() - 2, graph.size() - 1));
+    Path seam;
+    for (size_t i = 0u; i < ids.size(); ++i) {
+        seam.push_back(ids[i] % gray[0].size());
+    }
+    return seam;
+}
+
+void test_find_seam_2()
+{
+    print_header("test_find_seam_2");
+    for (unsigned seed = 1u; seed <= 6u; ++seed) {
+        GrayImage gray(random_gray_image(8 + seed, 5 + 2 * seed, seed, seed % 2 ? 3 : 1000));
+        Path expected(reference_seam(gray));
+        check_equal(expected, find_seam_graph(gray));
+        check_equal(expected, find_seam(gray));
+    }
+    GrayImage column = {{0.3}, {0.1}, {0.2}};
+    check_equal({0, 0, 0}, find_seam(column));
+}
+
+void test_cumulative_energy_1()
+{
+    GrayImage energy = {{0.0, 0.1, 0.2},
+                        {0.5, 0.3, 0.4},
+                        {0.8, 0.7, 0.6},
+                        {0.9, 0.91, 0.92}};
+    GrayImage expected = {{0.0, 0.1, 0.2},
+                          {0.5, 0.3, 0.5},
+                          {1.1, 1.0, 0.9},
+                          {1.9, 1.81, 1.82}};
+    print_header("test_cumulative_energy_1");
+    FlatGrayImage cumulative;
+    FlatOffsetImage predecessors;
+    cumulative_energy(to_flat(energy), cumulative, predecessors);
+    check_equal(expected, to_nested(cumulative));
+    check_equal({0, 1, 2, 1}, backtrack_seam(cumulative.row(3), predecessors));
+}
+
+void test_filter_simd_1()
+{
+    print_header("test_filter_simd_1");
+    const Kernel kernel5(5, std::vector<double>({0.01, -0.2, 0.3, 0.04, 0.5}));
+    const Kernel kernels[] = {SMOOTH_KERNEL, SOBEL_X_KERNEL, kernel5};
+    FlatGrayImage gray(to_flat(random_gray_image(13, 21, 11, 1000)));
+    for (Kernel const& kernel : kernels) {
+        set_simd_enabled(false);
+        FlatGrayImage expected(filter(gray, kernel));
+        set_simd_enabled(true);
+        FlatGrayImage computed(filter(gray, kernel));
+        check_equal(1, int(expected.pixels == computed.pixels));     // Exactly the same values
+    }
+}
+
+void test_fused_energy_1()
+{
+    print_header("test_fused_energy_1");
+    GrayImage shapes[] = {random_gray_image(9, 11, 7, 1000), random_gray_image(1, 6, 8, 1000),
+                          random_gray_image(5, 1, 9, 1000), random_gray_image(2, 2, 10, 1000)};
+    for (GrayImage const& gray : shapes) {
+        check_equal(sobel(smooth(gray)), to_nested(fused_energy(to_flat(gray))));
+    }
+}
+
+void test_flat_image_1()
+{
+    GrayImage gray = {{0.0, 0.1, 0.2},
+                      {0.5, 0.3, 0.4},
+                      {0.8, 0.7, 0.6},
+                      {0.9, 0.91, 0.92}};
+    print_header("test_flat_image_1");
+    FlatGrayImage flat(to_flat(gray));
+    check_equal(3, int(flat.width));
+    check_equal(4, int(flat.height));
+    check_equal(3, int(flat.stride));
+    check_equal(0.7, flat(2, 1));
+    check_equal(gray, to_nested(flat));
+    check_equal(sobel(smooth(gray)), to_nested(sobel(smooth(flat))));
+}
+
+void test_remove_seam_flat_1()
+{
+    GrayImage gray = {{0.0, 0.1, 0.2},
+                      {0.5, 0.3, 0.4},
+                      {0.8, 0.7, 0.6},
+                      {0.9, 0.91, 0.92}};
+    GrayImage expected = {{0.1, 0.2},
+                          {0.5, 0.4},
+                          {0.8, 0.7},
+                          {0.9, 0.92}};
+    Path seam = {0, 1, 2, 1};
+    print_header("test_remove_seam_flat_1");
+    check_equal(expected, to_nested(remove_seam(to_flat(gray), seam)));
+    FlatGrayImage flat(to_flat(gray));
+    remove_seam_in_place(flat, seam);
+    check_equal(2, int(flat.width));
+    check_equal(3, int(flat.stride));
+    check_equal(expected, to_nested(flat));
+}
+
+RGBImage random_rgb_image(size_t rows, size_t cols, unsigned seed)
+{
+    srand(seed);
+    RGBImage image(rows, std::vector<int>(cols));
+    for (size_t i = 0u; i < rows; ++i) {
+        for (size_t j = 0u; j < cols; ++j) {
+            image[i][j] = rand() & 0xFFFFFF;
+        }
+    }
+    return image;
+}
+
+void test_horizontal_seam_1()
+{
+    GrayImage energy = {{0.0, 0.5, 0.8, 0.9},
+                        {0.1, 0.3, 0.7, 0.91},
+                        {0.2, 0.4, 0.6, 0.92}};
+    print_header("test_horizontal_seam_1");
+    check_equal(energy, to_nested(transpose(transpose(to_flat(energy)))));
+    check_equal({0, 1, 2, 1}, find_horizontal_seam(energy));
+
+    RGBImage image(random_rgb_image(40, 35, 23));           // Larger than the transposition blocks
+    FlatRGBImage transposed(transpose(to_flat(image)));
+    check_equal(40, int(transposed.width));
+    check_equal(image[37][33], transposed(33, 37));
+    FlatRGBImage carved(carve_horizontal_seams(to_flat(image), 3));
+    check_equal(35, int(carved.width));
+    check_equal(37, int(carved.height));
+    check_equal(to_nested(transpose(carve_seams(transpose(to_flat(image)), 3))), to_nested(carved));
+
+    RGBImage expected(image);                               // Seams removed one by one, without transposing the image
+    for (int k(0); k < 3; ++k) {
+        Path seam(find_horizontal_seam(sobel(smooth(to_gray(expected)))));
+        RGBImage removed(expected.size() - 1, std::vector<int>(expected[0].size()));
+        for (size_t col(0); col < seam.size(); ++col) {
+            for (size_t row(0); row < removed.size(); ++row) {
+                removed[row][col] = expected[row < seam[col] ? row : row + 1][col];
+            }
+        }
+        expected = removed;
+    }
+    check_equal(expected, to_nested(carved));
+}
+
+void test_remove_seams_1()
+{
+    print_header("test_remove_seams_1");
+    SeamList seams = {{1, 2, 1}, {1, 1, 2}};
+    SeamList originals(to_original_coordinates(seams));
+    check_equal({1, 2, 1}, originals[0]);
+    check_equal({2, 1, 3}, originals[1]);
+
+    RGBImage image(random_rgb_image(7, 10, 5));
+    seams.clear();
+    RGBImage expected(image);
+    for (int i = 0; i < 4; ++i) {
+        seams.push_back(find_seam(to_gray(expected)));
+        expected = remove_seam(expected, seams.back());
+    }
+    check_equal(expected, remove_seams(image, to_original_coordinates(seams)));
+}
+
+void test_carve_seams_1()
+{
+    print_header("test_carve_seams_1");
+    RGBImage image(random_rgb_image(12, 15, 42));
+    RGBImage expected(image);
+    for (int i = 0; i < 6; ++i) {
+        expected = remove_seam(expected, find_seam(sobel(smooth(to_gray(expected)))));
+    }
+    CarvingState state(start_carving(to_flat(image)));
+    for (int i = 0; i < 6; ++i) {
+        carve_seam(state);
+    }
+    check_equal(expected, to_nested(state.image));
+    check_equal(to_gray(expected), to_nested(state.gray));
+    check_equal(sobel(smooth(to_gray(expected))), to_nested(state.energy));
+    FlatGrayImage cumulative;
+    FlatOffsetImage predecessors;
+    cumulative_energy(state.energy, cumulative, predecessors);
+    check_equal(to_nested(cumulative), to_nested(state.cumulative));
+    check_equal(expected, to_nested(carve_seams(to_flat(image), 6)));
+}
+
+void test_index_map_1()
+{
+    print_header("test_index_map_1");
+    RGBImage image(random_rgb_image(9, 12, 17));
+    SeamIndexMap map(build_index_map(to_flat(image), 5));
+    check_equal(5, int(map.min_width));
+    for (size_t width = 12u; width >= 5u; width -= 3u) {
+        check_equal(to_nested(carve_seams(to_flat(image), 12u - width)), to_nested(retarget(to_flat(image), map, width)));
+    }
+}
+
+void test_index_map_file_1()
+{
+    print_header("test_index_map_file_1");
+    const std::string name("test_index_map.tmp");
+    RGBImage image(random_rgb_image(9, 12, 19));
+    SeamIndexMap map(build_index_map(to_flat(image), 4));
+    IndexMapEncoding encodings[] = {INDEX_MAP_RAW, INDEX_MAP_DELTA_RLE};
+    for (IndexMapEncoding encoding : encodings) {
+        write_index_map(map, name, encoding);
+        SeamIndexMap read(read_index_map(name));
+        check_equal(int(map.min_width), int(read.min_width));
+        check_equal(1, int(map.order.pixels == read.order.pixels));
+    }
+
+    MappedIndexMap mapped;
+    check_equal(0, int(mapped.open(name)));                // Compressed file can't be mapped
+    write_index_map(map, name);
+    check_equal(1, int(mapped.open(name)));
+    check_equal(16, mapped.order_bits());
+    check_equal(int(map.order(3, 5)), int(mapped.order(3, 5)));
+    check_equal(to_nested(retarget(to_flat(image), map, 7)), to_nested(retarget(to_flat(image), mapped, 7)));
+    mapped.close();
+
+    SeamIndexMap large;                                     // Orders which need 32 bits
+    large.width = 70000;
+    large.height = 2;
+    large.min_width = 1;
+    large.direction = SEAM_VERTICAL;
+    large.energy = ENERGY_SOBEL;
+    large.order = FlatImage<uint32_t>(large.width, large.height, NOT_REMOVED);
+    for (uint32_t col = 1u; col < large.width; ++col) {
+        large.order(0, col) = col - 1;
+        large.order(1, col) = (col * 7919u) % (large.width - 1);
+    }
+    for (IndexMapEncoding encoding : encodings) {
+        write_index_map(large, name, encoding);
+        check_equal(1, int(large.order.pixels == read_index_map(name).order.pixels));
+    }
+    check_equal(0, int(mapped.open(name)));
+    write_index_map(large, name);
+    check_equal(1, int(mapped.open(name)));
+    check_equal(32, mapped.order_bits());
+    check_equal(int(large.order(1, 12345)), int(mapped.order(1, 12345)));
+    mapped.close();
+    std::remove(name.c_str());
+}
+
+// Writes bytes in the file name (used to corrupt index map files).
+static void write_bytes(const std::string &name, const std::string &bytes)
+{
+    std::ofstream file(name.c_str(), std::ios::binary);
+    file.write(bytes.data(), bytes.size());
+}
+
+void test_index_map_file_2()
+{
+    print_header("test_index_map_file_2");
+    const std::string name("test_index_map.tmp");
+    RGBImage image(random_rgb_image(6, 8, 23));
+    SeamIndexMap map(build_index_map(to_flat(image), 3));
+    MappedIndexMap mapped;
+
+    write_index_map(map, name);
+    std::string raw;
+    {
+        std::ifstream file(name.c_str(), std::ios::binary);
+        raw.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+    check_equal(64 + 6 * 8 * 2, int(raw.size()));
+    std::string corrupted(raw);
+    corrupted[32] = char(0xFF);                             // payload_size larger than the file
+    corrupted.replace(33, 7, 7, char(0xFF));
+    write_bytes(name, corrupted);
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    check_equal(0, int(mapped.open(name)));
+    corrupted = raw;
+    corrupted[24] = 7;                                      // Height 7 instead of 6
+    write_bytes(name, corrupted);
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    check_equal(0, int(mapped.open(name)));
+    corrupted = raw;
+    corrupted[20] = char(0xFF);                             // Width of 0xFFFFFFFF : payload far too short
+    corrupted.replace(21, 3, 3, char(0xFF));
+    write_bytes(name, corrupted + std::string(16, '\0'));
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    check_equal(0, int(mapped.open(name)));
+    corrupted = raw;                                        // Valid header, every order NOT_REMOVED
+    corrupted.replace(64, raw.size() - 64, raw.size() - 64, char(0xFF));
+    write_bytes(name, corrupted);
+    check_equal(1, int(mapped.open(name)));
+    check_equal(0, int(retarget(to_flat(image), mapped, 5).pixels.size()));
+    SeamIndexMap wrong(read_index_map(name));
+    check_equal(0, int(retarget(to_flat(image), wrong, 5).pixels.size()));
+    wrong = map;                                            // One pixel too few on a row
+    *std::find(wrong.order.row(2), wrong.order.row(2) + wrong.width, NOT_REMOVED) = 0;
+    check_equal(0, int(retarget(to_flat(image), wrong, 7).pixels.size()));
+    mapped.close();
+    write_bytes(name, raw);
+    check_equal(1, int(mapped.open(name)));
+    check_equal(to_nested(retarget(to_flat(image), map, 5)), to_nested(retarget(to_flat(image), mapped, 5)));
+    mapped.close();
+
+    write_index_map(map, name, INDEX_MAP_DELTA_RLE);
+    std::string compressed;
+    {
+        std::ifstream file(name.c_str(), std::ios::binary);
+        compressed.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+    check_equal(1, int(map.order.pixels == read_index_map(name).order.pixels));
+    corrupted = compressed + std::string(1, '\2');           // One more zero after the last pixel
+    corrupted[32] = char(corrupted[32] + 1);
+    write_bytes(name, corrupted);
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    corrupted = compressed;
+    corrupted[64] = 0;                                      // Token 0 (empty run)
+    write_bytes(name, corrupted);
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    corrupted = compressed.substr(0, compressed.size() - 1); // Truncated stream
+    corrupted[32] = char(corrupted[32] - 1);
+    write_bytes(name, corrupted);
+    check_equal(0, int(read_index_map(name).order.pixels.size()));
+    std::remove(name.c_str());
+}
+
+void test_profiler_1()
+{
+    print_header("test_profiler_1");
+    reset_profile();
+    find_seam(to_flat(random_gray_image(4, 5, 3, 1000)));
+    check_equal(std::string("{\"timers\": {}, \"counters\": {}}"), profile_json());  // Disabled by default
+
+    set_profiling(true);
+    GrayImage gray(random_gray_image(4, 5, 3, 1000));
+    find_seam(to_flat(gray));
+    Graph graph(create_graph(gray));
+    shortest_path(graph, graph.size() - 2, graph.size() - 1);
+    set_profiling(false);
+    std::string json(profile_json());
+    check_equal(1, int(json.find("\"find_seam\": {\"calls\": 1") != std::string::npos));
+    check_equal(1, int(json.find("\"find_seam.pixels\": 20") != std::string::npos));
+    check_equal(1, int(json.find("\"shortest_path.passes\": 3") != std::string::npos));
+    reset_profile();
+}
+
+void test_thread_pool_1()
+{
+    print_header("test_thread_pool_1");
+    const size_t previous(thread_count());
+    set_thread_count(4);
+    std::vector<int> covered(1000, 0);
+    parallel_rows(covered.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i(first) ; i < last ; ++i) {
+            covered[i] += 1;
+        }
+    }, 0);
+    check_equal(1000, int(std::count(covered.begin(), covered.end(), 1)));      // Each row exactly once
+
+    // Same results whatever the number of threads (the image is large enough to be split)
+    FlatRGBImage image(to_flat(random_rgb_image(301, 257, 12)));
+    set_thread_count(1);
+    FlatGrayImage gray(to_gray(image));
+    FlatGrayImage energy(sobel(smooth(gray)));
+    FlatGrayImage fused(fused_energy(gray));
+    FlatRGBImage rgb(to_RGB(energy));
+    const size_t counts[] = {2, 3, 8};
+    for (size_t threads : counts) {
+        set_thread_count(threads);
+        check_equal(1, int(to_gray(image).pixels == gray.pixels));
+        check_equal(1, int(sobel(smooth(gray)).pixels == energy.pixels));
+        check_equal(1, int(fused_energy(gray).pixels == fused.pixels));
+        check_equal(1, int(to_RGB(energy).pixels == rgb.pixels));
+    }
+    set_thread_count(previous);
+}
+
+void test_parallel_seam_1()
+{
+    print_header("test_parallel_seam_1");
+    const size_t previous(thread_count());
+    FlatGrayImage energy(to_flat(random_gray_image(40, 97, 13, 20)));     // Few levels : many ties
+    set_thread_count(1);
+    Path expected(find_seam(energy));
+    FlatGrayImage cumulative;
+    FlatOffsetImage predecessors;
+    cumulative_energy(energy, cumulative, predecessors);
+
+    set_seam_min_columns(8);                                               // Splits the rows even if they are small
+    const size_t counts[] = {2, 3, 4, 16};
+    for (size_t threads : counts) {
+        set_thread_count(threads);
+        check_equal(expected, find_seam(energy));
+        FlatGrayImage parallel_cumulative;
+        FlatOffsetImage parallel_predecessors;
+        cumulative_energy(energy, parallel_cumulative, parallel_predecessors);
+        check_equal(1, int(parallel_cumulative.pixels == cumulative.pixels
+                           && parallel_predecessors.pixels == predecessors.pixels));
+    }
+    set_seam_min_columns(4096);
+    set_thread_count(previous);
+}
+
+void test_packed_offsets_1()
+{
+    print_header("test_packed_offsets_1");
+    PackedOffsets offsets(10, 2);
+    check_equal(6, int(offsets.bytes.size()));                             // 3 bytes per row of 10 pixels
+    offsets.row(1)[2] = 0x06;                                              // Columns 8 and 9 : +1 and 0
+    check_equal(1, offsets(1, 8));
+    check_equal(0, offsets(1, 9));
+    check_equal(-1, offsets(1, 7));
+
+    // Same seams as with the predecessors of cumulative_energy (one byte per pixel), whatever the
+    // width (partial bytes) and the number of threads (chunks of columns)
+    const size_t previous(thread_count());
+    set_seam_min_columns(1);
+    bool same(true);
+    for (size_t largeur(1) ; largeur <= 23 ; ++largeur) {
+        FlatGrayImage energy(to_flat(random_gray_image(9, largeur, unsigned(largeur), 4)));
+        FlatGrayImage cumulative;
+        FlatOffsetImage predecessors;
+        cumulative_energy(energy, cumulative, predecessors);
+        const Path expected(backtrack_seam(cumulative.row(energy.height - 1), predecessors));
+        for (size_t threads : {1, 3, 4}) {
+            set_thread_count(threads);
+            same = same && find_seam(energy) == expected;
+        }
+    }
+    check_equal(1, int(same));
+    set_seam_min_columns(4096);
+    set_thread_count(previous);
+}
+
+void test_seam_memory_1()
+{
+    print_header("test_seam_memory_1");
+    const size_t previous(thread_count());
+    set_seam_min_columns(1);
+    bool same(true);
+    for (unsigned seed(0) ; seed < 12 ; ++seed) {
+        const GrayImage gray(random_gray_image(1 + seed % 5 * 4, 1 + seed * 3, seed, seed % 2 ? 3 : 1000));
+        const FlatGrayImage energy(to_flat(gray));
+        const Path expected(find_seam_graph(gray));                         // Seam of the graph search
+        FlatEnergy16Image energy16(energy.width, energy.height);
+        for (size_t k(0) ; k < energy.pixels.size() ; ++k) {
+            energy16.pixels[k] = uint16_t(energy.pixels[k] * 1000);
+        }
+        const Path expected16(find_seam(energy16, SEAM_FULL_TABLE));
+        for (size_t threads : {1, 4}) {
+            set_thread_count(threads);
+            same = same && find_seam(energy, SEAM_TWO_ROWS) == expected && find_seam(energy, SEAM_FULL_TABLE) == expected
+                        && find_seam(energy16, SEAM_TWO_ROWS) == expected16;
+        }
+    }
+    check_equal(1, int(same));
+    set_seam_min_columns(4096);
+    set_thread_count(previous);
+}
+
+// Forward energy seam computed with the formulas of Rubinstein et al. on the nested image.
+static Path forward_seam_reference(const GrayImage &gray)
+{
+    const size_t hauteur(gray.size()), largeur(gray[0].size());
+    GrayImage distances(hauteur, std::vector<double>(largeur));
+    std::vector<std::vector<int>> offsets(hauteur, std::vector<int>(largeur, 0));
+    for (size_t row(0) ; row < hauteur ; ++row) {
+        for (size_t col(0) ; col < largeur ; ++col) {
+            const double left(gray[row][col > 0 ? col-1 : col]), right(gray[row][col+1 < largeur ? col+1 : col]);
+            const double middle(std::fabs(right - left));
+            if (row == 0) {
+                distances[row][col] = middle;
+                continue;
+            }
+            const double above(gray[row-1][col]);
+            const double costs[3] = {middle + std::fabs(above - left), middle, middle + std::fabs(above - right)};
+            double best(std::numeric_limits<double>::max());
+            for (int k(-1) ; k <= 1 ; ++k) {
+                if ((k < 0 && col == 0) || (k > 0 && col+1 == largeur)) {
+                    continue;
+                }
+                if (distances[row-1][col+k] + costs[k+1] < best) {
+                    best = distances[row-1][col+k] + costs[k+1];
+                    offsets[row][col] = k;
+                }
+            }
+            distances[row][col] = best;
+        }
+    }
+    Path seam(hauteur);
+    seam[hauteur-1] = std::min_element(distances[hauteur-1].begin(), distances[hauteur-1].end()) - distances[hauteur-1].begin();
+    for (size_t row(hauteur-1) ; row > 0 ; --row) {
+        seam[row-1] = seam[row] + offsets[row][seam[row]];
+    }
+    return seam;
+}
+
+void test_forward_energy_1()
+{
+    print_header("test_forward_energy_1");
+    // Constant columns : removing column 3 makes two equal columns adjacent, for free
+    const GrayImage stripes(6, std::vector<double>({0.0, 0.5, 1.0, 1.0, 1.0, 0.2}));
+    check_equal(Path(6, 3), find_seam_forward(to_flat(stripes)));
+
+    const size_t previous(thread_count());
+    set_seam_min_columns(1);
+    bool same(true);
+    for (unsigned seed(0) ; seed < 12 ; ++seed) {
+        const GrayImage gray(random_gray_image(1 + seed % 4 * 5, 1 + seed * 3, seed, seed % 2 ? 3 : 1000));
+        const Path expected(forward_seam_reference(gray));
+        for (bool simd : {false, true}) {
+            set_simd_enabled(simd);
+            for (size_t threads : {1, 4}) {
+                set_thread_count(threads);
+                same = same && find_seam_forward(to_flat(gray)) == expected
+                            && find_seam_forward(to_flat(gray), SEAM_FULL_TABLE) == expected;
+            }
+        }
+    }
+    check_equal(1, int(same));
+    set_simd_enabled(true);
+    set_seam_min_columns(4096);
+    set_thread_count(previous);
+
+    // Carving, with a map whose seams are the same
+    const FlatRGBImage image(to_flat(random_rgb_image(12, 17, 5)));
+    const FlatRGBImage carved(carve_seams(image, 6, ENERGY_FORWARD));
+    check_equal(11, int(carved.width));
+    const SeamIndexMap map(build_index_map(image, 8, ENERGY_FORWARD));
+    check_equal(int(ENERGY_FORWARD), int(map.energy));
+    check_equal(1, int(retarget(image, map, 11).pixels == carved.pixels));
+}
+
+void test_pyramid_1()
+{
+    print_header("test_pyramid_1");
+    GrayImage energy = {{1, 2, 3, 4, 5},
+                        {6, 7, 8, 9, 10},
+                        {11, 12, 13, 14, 15}};
+    check_equal(GrayImage({{16, 24, 15}, {23, 27, 15}}), to_nested(downsample(to_flat(energy))));
+
+    // Corridors covering the whole rows : exactly the seam of find_seam
+    const FlatGrayImage random(to_flat(random_gray_image(40, 97, 13, 20)));
+    check_equal(find_seam(random), find_seam_pyramid(random, 200, 4));
+    check_equal(find_seam(random), find_seam_pyramid(random, 4, 64));      // Too small for a coarser level
+    check_equal(0.0, seam_energy_deviation(random, find_seam(random)));
+
+    // Narrow corridors : a valid seam, at least as expensive as the exact one
+    const FlatGrayImage gray(to_gray(to_flat(random_rgb_image(150, 120, 3))));
+    const FlatGrayImage sobeled(sobel(smooth(gray)));
+    const Path seam(find_seam_pyramid(sobeled, 1, 8));
+    bool valid(seam.size() == sobeled.height && seam[0] < sobeled.width);
+    for (size_t row(1) ; row < seam.size() ; ++row) {                     // Connected pixels of the image
+        valid = valid && seam[row] < sobeled.width && seam[row] + 1 >= seam[row-1] && seam[row] <= seam[row-1] + 1;
+    }
+    check_equal(1, int(valid));
+    check_equal(1, int(seam_energy_deviation(sobeled, seam) >= 0.0));
+}
+
+void test_column_window_1()
+{
+    print_header("test_column_window_1");
+    const FlatGrayImage energy(to_flat(random_gray_image(40, 97, 13, 20)));    // Few levels : many ties
+    check_equal(find_seam(energy), find_seam(energy, ColumnWindow(40, 0, 96)));
+    FlatEnergy16Image energy16(energy.width, energy.height);
+    for (size_t k(0) ; k < energy.pixels.size() ; ++k) {
+        energy16.pixels[k] = uint16_t(energy.pixels[k] * 20);
+    }
+    check_equal(find_seam(energy16), find_seam(energy16, ColumnWindow(40, 0, 96)));
+
+    // A band : the seam of the image made of the columns of the band
+    FlatGrayImage band(5, energy.height);
+    for (size_t row(0) ; row < energy.height ; ++row) {
+        std::copy(energy.row(row) + 30, energy.row(row) + 35, band.row(row));
+    }
+    Path expected(find_seam(band));
+    for (size_t &col : expected) {
+        col += 30;
+    }
+    reset_profile();
+    set_profiling(true);
+    check_equal(expected, find_seam(energy, ColumnWindow(40, 30, 34)));
+    set_profiling(false);
+    check_equal(1, int(profile_json().find("\"find_seam.pixels\": 200") != std::string::npos));   // Only the band
+    reset_profile();
+
+    // Corridors around random walks : same seam as with huge energies outside the corridor
+    srand(7);
+    bool same(true);
+    for (int walk(0) ; walk < 20 ; ++walk) {
+        ColumnWindow corridor(40, 0, 0);
+        FlatGrayImage fenced(energy);
+        size_t center(rand() % 97);
+        for (size_t row(0) ; row < 40 ; ++row) {
+            center = std::min(size_t(96), std::max(size_t(1), center + rand() % 3) - 1);
+            corridor.first[row] = center - std::min(center, size_t(rand() % 4));
+            corridor.last[row] = std::min(size_t(96), center + rand() % 4);
+            for (size_t col(0) ; col < 97 ; ++col) {
+                if (col < corridor.first[row] || col > corridor.last[row]) {
+                    fenced(row, col) = 1e12;
+                }
+            }
+        }
+        same = same && find_seam(energy, corridor) == find_seam(fenced);
+    }
+    check_equal(1, int(same));
+
+    // Windows of different rows without a connection : no seam
+    ColumnWindow apart(40, 0, 3);
+    apart.first[20] = apart.last[20] = 10;
+    check_equal(Path(), find_seam(energy, apart));
+}
+
+void test_work_stealing_pool_1()
+{
+    print_header("test_work_stealing_pool_1");
+    std::vector<int> done(64, 0);
+    {
+        WorkStealingPool pool(3);
+        for (size_t i(0) ; i < done.size() ; i += 2) {
+            pool.submit([&done, &pool, i]() {
+                done[i] += 1;
+                pool.submit([&done, i]() { done[i+1] += 1; });     // Submitted from a worker
+            });
+        }
+        pool.wait();
+        check_equal(64, int(std::count(done.begin(), done.end(), 1)));
+    }
+}
+
+void test_batch_1()
+{
+    print_header("test_batch_1");
+    const std::string manifest("test_batch_manifest.tmp");
+    write_image(random_rgb_image(12, 20, 14), "test_batch_1.png");
+    write_image(random_rgb_image(15, 9, 15), "test_batch_2.png");
+    std::ofstream file(manifest.c_str());
+    file << "# input width height output\n"
+         << "test_batch_1.png 16 10 test_batch_1_out.png\n"
+         << "\n"
+         << "test_batch_2.png 9 11 test_batch_2_out.png\n"
+         << "test_batch_2.png 10 11 test_batch_3_out.png\n"       // Too wide
+         << "test_batch_1.png 16 10 test_batch_missing/out.png\n"  // Can't be written
+         << "test_batch_2.png 10\n";                               // Malformed
+    file.close();
+
+    std::vector<BatchJob> jobs(read_manifest(manifest));
+    check_equal(4, int(jobs.size()));
+    // Same pixels as carving by hand, with both drivers
+    FlatRGBImage expected(carve_horizontal_seams(carve_seams(to_flat(read_image("test_batch_1.png")), 4), 2));
+    for (int pipeline(0) ; pipeline < 2 ; ++pipeline) {
+        BatchStats stats(pipeline ? run_pipeline(jobs, 1) : run_batch(jobs, 2, 1));
+        check_equal(2, int(stats.images));
+        check_equal(2, int(stats.failed));
+        check_equal(12*20 + 15*9, int(stats.pixels));
+        check_equal(to_nested(expected), read_image("test_batch_1_out.png"));
+        check_equal(11, int(read_image("test_batch_2_out.png").size()));
+        std::remove("test_batch_1_out.png");
+    }
+
+    const char *files[] = {"test_batch_manifest.tmp", "test_batch_1.png", "test_batch_2.png",
+                           "test_batch_1_out.png", "test_batch_2_out.png"};
+    for (const char *name : files) {
+        std::remove(name);
+    }
+}
+
+void test_decoded_image_1()
+{
+    print_header("test_decoded_image_1");
+    RGBImage image(random_rgb_image(7, 13, 16));
+    write_image(image, "test_decoded_image.png");
+    DecodedImage decoded;
+    check_equal(1, int(decoded.open("test_decoded_image.png")));
+    check_equal(13, int(decoded.width()));
+    check_equal(7, int(decoded.height()));
+    check_equal(image, to_nested(to_flat(decoded)));
+    check_equal(1, int(to_gray(decoded).pixels == to_gray(to_flat(image)).pixels));  // Exactly the same values
+    check_equal(to_gray(image), to_nested(to_gray(decoded)));
+    decoded.close();
+    check_equal(1, int(decoded.empty()));
+    check_equal(0, int(decoded.open("test_decoded_image_missing.png")));
+    std::remove("test_decoded_image.png");
+}
+
+void test_fixed_point_1()
+{
+    print_header("test_fixed_point_1");
+    const uint32_t values[] = {0, 1, 2, 3, 4, 15, 16, 17, 99, 100, 65535, 65536, 208080000, 4294967295u};
+    bool exact(true);
+    for (uint32_t value : values) {
+        const uint32_t root(isqrt(value));
+        exact = exact && uint64_t(root) * root <= value && uint64_t(root + 1) * (root + 1) > value;
+    }
+    for (uint32_t n(1) ; n < 65536 ; ++n) {                               // Around every perfect square
+        exact = exact && isqrt(n*n) == n && isqrt(n*n - 1) == n - 1;
+    }
+    check_equal(1, int(exact));
+
+    // Same values as the double filters applied to integers (exact sums)
+    FlatRGBImage image(to_flat(random_rgb_image(9, 14, 17)));
+    FlatGray8Image gray8(to_gray8(image));
+    FlatGrayImage gray(gray8.width, gray8.height);
+    std::copy(gray8.pixels.begin(), gray8.pixels.end(), gray.pixels.begin());
+    const Kernel box({{1, 1, 1}, {1, 2, 1}, {1, 1, 1}});
+    FlatGrayImage smoothed(filter(gray, box));
+    FlatEnergy16Image smoothed16(smooth_fixed(gray8));
+    check_equal(1, int(std::equal(smoothed16.pixels.begin(), smoothed16.pixels.end(), smoothed.pixels.begin())));
+    FlatGrayImage sobel_x(sobelX(smoothed)), sobel_y(sobelY(smoothed));
+    FlatEnergy16Image energy16(sobel_fixed(smoothed16));
+    bool same(true);
+    for (size_t k(0) ; k < energy16.pixels.size() ; ++k) {
+        const double x(sobel_x.pixels[k]), y(sobel_y.pixels[k]);
+        same = same && energy16.pixels[k] == uint16_t(std::floor(std::sqrt(x*x + y*y)));
+    }
+    check_equal(1, int(same));
+
+    // The integer search gives the seam of the double search on the same energies
+    FlatGrayImage energy(energy16.width, energy16.height);
+    std::copy(energy16.pixels.begin(), energy16.pixels.end(), energy.pixels.begin());
+    check_equal(find_seam(energy), find_seam(energy16));
+    FlatEnergy16Image flat_energy(5, 4, 7);                                // Ties : leftmost seam
+    check_equal(Path(4, 0), find_seam(flat_energy));
+
+    FlatRGBImage carved(carve_seams_fixed(image, 3));
+    check_equal(11, int(carved.width));
+    check_equal(9, int(carved.height));
+}
+
+// Filters gray with K and with the equivalent runtime kernel, with and without vector instructions.
+template <typename K>
+static bool same_as_runtime(const FlatGrayImage &gray)
+{
+    bool same(true);
+    for (bool simd : {false, true}) {
+        set_simd_enabled(simd);
+        FlatGrayImage expected(filter(gray, K::runtime()));
+        FlatGrayImage computed(filter<K>(gray));
+        same = same && expected.pixels == computed.pixels;
+        for (size_t row(0) ; row < gray.height ; ++row) {
+            for (size_t col(0) ; col < gray.width ; ++col) {
+                same = same && filter_pixel<K>(gray, row, col) == expected(row, col);
+            }
+        }
+    }
+    set_simd_enabled(true);
+    return same;
+}
+
+void test_fixed_kernel_1()
+{
+    print_header("test_fixed_kernel_1");
+    typedef FixedKernel<100,  1, -20, 30,  4, 50,
+                             -3,   0,  7,  0, 12,
+                              5,   9,  0, 11, -6,
+                              0,   2,  8, -1, 13,
+                             40,   0, 17,  3,  1> Kernel5;
+    check_equal(3, int(SmoothKernel::size));
+    check_equal(5, int(Kernel5::size));
+    check_equal(1, int(SmoothKernel::runtime() == SMOOTH_KERNEL));
+    check_equal(1, int(SobelXKernel::runtime() == SOBEL_X_KERNEL));
+    check_equal(1, int(SobelYKernel::runtime() == SOBEL_Y_KERNEL));
+
+    FlatGrayImage shapes[] = {to_flat(random_gray_image(13, 21, 11, 1000)), to_flat(random_gray_image(1, 6, 8, 1000)),
+                              to_flat(random_gray_image(5, 1, 9, 1000)), to_flat(random_gray_image(4, 7, 10, 1000))};
+    for (FlatGrayImage const& gray : shapes) {
+        check_equal(1, int(same_as_runtime<SmoothKernel>(gray)));
+        check_equal(1, int(same_as_runtime<SobelXKernel>(gray)));
+        check_equal(1, int(same_as_runtime<SobelYKernel>(gray)));
+        check_equal(1, int(same_as_runtime<Kernel5>(gray)));
+    }
+}
+
 void run_unit_tests() 
 {
     test_color();
@@ -551,4 +1395,30 @@ void run_unit_tests()
     //test_shortest_path_1();
     //test_shortest_path_2();
     //test_find_seam_1();
+    test_shortest_path_dag_1();
+    test_find_seam_2();
+    test_cumulative_energy_1();
+    test_flat_image_1();
+    test_filter_simd_1();
+    test_fused_energy_1();
+    test_remove_seam_flat_1();
+    test_horizontal_seam_1();
+    test_remove_seams_1();
+    test_carve_seams_1();
+    test_index_map_1();
+    test_index_map_file_1();
+    test_index_map_file_2();
+    test_profiler_1();
+    test_thread_pool_1();
+    test_parallel_seam_1();
+    test_packed_offsets_1();
+    test_seam_memory_1();
+    test_forward_energy_1();
+    test_pyramid_1();
+    test_column_window_1();
+    test_work_stealing_pool_1();
+    test_batch_1();
+    test_decoded_image_1();
+    test_fixed_point_1();
+    test_fixed_kernel_1();
 }
@@ -39,6 +39,10 @@ void check_equal(Path const& expected, Path const& computed);
 
 void check_equal(GrayImage const& expected, GrayImage const& computed);
 
+void check_equal(RGBImage const& expected, RGBImage const& computed);
+
+void check_equal(std::string const& expected, std::string const& computed);
+
 void test_color();
 
 void test_to_gray_2_2();
@@ -75,4 +79,61 @@ void test_shortest_path_2();
 
 void test_find_seam_1();
 
+void test_shortest_path_dag_1();
+
+GrayImage random_gray_image(size_t rows, size_t cols, unsigned seed, int levels);
+
+Path reference_seam(GrayImage const& gray);
+
+void test_find_seam_2();
+
+void test_cumulative_energy_1();
+
+void test_flat_image_1();
+
+void test_filter_simd_1();
+
+void test_fused_energy_1();
+
+void test_remove_seam_flat_1();
+
+RGBImage random_rgb_image(size_t rows, size_t cols, unsigned seed);
+
+void test_horizontal_seam_1();
+
+void test_remove_seams_1();
+
+void test_carve_seams_1();
+
+void test_index_map_1();
+
+void test_index_map_file_1();
+void test_index_map_file_2();
+
+void test_profiler_1();
+
+void test_thread_pool_1();
+
+void test_parallel_seam_1();
+
+void test_packed_offsets_1();
+
+void test_seam_memory_1();
+
+void test_forward_energy_1();
+
+void test_pyramid_1();
+
+void test_column_window_1();
+
+void test_work_stealing_pool_1();
+
+void test_batch_1();
+
+void test_decoded_image_1();
+
+void test_fixed_point_1();
+
+void test_fixed_kernel_1();
+
 void run_unit_tests();